@@ -0,0 +1,18 @@
+#version 330 core
+
+out vec4 FragColor;
+
+// Weighted colors of the objects blended order-independently, with the product of their 
+// transparencies as alpha, and the sum of their weights.
+uniform sampler2D accumulation;
+uniform sampler2D weights;
+
+void main()
+{
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  vec4 accum = texelFetch(accumulation, texel, 0);
+  float revealage = accum.a;
+  if (revealage >= 1.0) discard;
+  float weight = texelFetch(weights, texel, 0).r;
+  FragColor = vec4(accum.rgb / max(weight, 1e-5), 1.0 - revealage);
+}
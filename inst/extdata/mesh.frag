@@ -1,14 +1,33 @@
 #version 330 core
 
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+// Weight of the fragment, written only while drawing objects blended order-independently.
+layout (location = 1) out vec4 FragWeight;
 
 in vec3 crntPos;
 in vec3 normal;
 in vec4 crntCol;
+in vec4 clipPos;
 
-uniform int nlights;
-uniform float lightArray[900];
-uniform vec3 camPos;
+// Lights without a range, shaded by every fragment.
+layout (std140) uniform Lights
+{
+  int nlights;
+  ivec4 clusterCounts;  // clusters across, up and in depth, and the number of local lights
+  vec4 clusterDepths;   // near plane and depth slices per unit of log depth
+  vec4 lightArray[300]; // position, direction and color of each light
+};
+
+// Lights with a range as three texels each: position and range, direction and 1 for a spotlight, color.
+uniform samplerBuffer localLights;
+// First index into lightIndices and number of the local lights reaching each cluster of the view frustum.
+uniform usamplerBuffer lightClusters;
+uniform usamplerBuffer lightIndices;
+
+// Whether to write colors weighted for order-independent transparency, to be composited by composite.frag.
+uniform bool orderIndependent;
+
+const float SPOT_COS = 0.8660254; // spotlights light a cone 30 degrees either side of their direction
 
 vec3 direcLight(vec3 lightPos, vec3 lightDir, vec3 lightCol)
 { 
@@ -22,6 +41,35 @@ vec3 direcLight(vec3 lightPos, vec3 lightDir, vec3 lightCol)
 	return (diffuse + ambient + specular) * lightCol * crntCol.rgb;
 }
 
+vec3 localLight(int i)
+{
+  vec4 posRange = texelFetch(localLights, 3 * i);
+  vec4 dirSpot = texelFetch(localLights, 3 * i + 1);
+  vec3 lightCol = texelFetch(localLights, 3 * i + 2).rgb;
+  vec3 toFrag = crntPos - posRange.xyz;
+  float dist = length(toFrag);
+  vec3 lightDir = toFrag / max(dist, 1e-6);
+  // Fade smoothly to nothing at the range.
+  float fade = clamp(1.0 - pow(dist / posRange.w, 4.0), 0.0, 1.0);
+  fade *= fade;
+  if (dirSpot.w > 0.5) fade *= smoothstep(SPOT_COS, SPOT_COS + 0.02, dot(lightDir, dirSpot.xyz));
+  return direcLight(posRange.xyz, lightDir, fade * lightCol);
+}
+
+vec3 iterate_over_local_lights()
+{
+  vec3 outColor = vec3(0.0);
+  if (clusterCounts.w == 0) return outColor;
+  ivec2 tile = ivec2((clipPos.xy / clipPos.w * 0.5 + 0.5) * vec2(clusterCounts.xy));
+  tile = clamp(tile, ivec2(0), clusterCounts.xy - 1);
+  int slice = clamp(int(log(clipPos.w / clusterDepths.x) * clusterDepths.y), 0, clusterCounts.z - 1);
+  uvec2 cluster = texelFetch(lightClusters, (slice * clusterCounts.y + tile.y) * clusterCounts.x + tile.x).xy;
+  for (uint k = 0u; k < cluster.y; k++) {
+    outColor = outColor + localLight(int(texelFetch(lightIndices, int(cluster.x + k)).x));
+  }
+  return outColor;
+}
+
 vec4 iterate_over_lights()
 {
   vec3 lightPos;
@@ -29,16 +77,30 @@ vec4 iterate_over_lights()
   vec3 lightCol;
   vec3 outColor = vec3(0.0);
   for (int i=0; i<nlights; i++) {
-    int idx = 9*i;
-	  lightPos = vec3(lightArray[0+idx], lightArray[1+idx], lightArray[2+idx]);
-    lightDir = vec3(lightArray[3+idx], lightArray[4+idx], lightArray[5+idx]);
-    lightCol = vec3(lightArray[6+idx], lightArray[7+idx], lightArray[8+idx]);
+    int idx = 3*i;
+	  lightPos = lightArray[idx].xyz;
+    lightDir = lightArray[idx + 1].xyz;
+    lightCol = lightArray[idx + 2].xyz;
     outColor = outColor + direcLight(lightPos, lightDir, lightCol);
 	}
+	outColor = outColor + iterate_over_local_lights();
 	return vec4(min(outColor.x, 1.0), min(outColor.y, 1.0), min(outColor.z, 1.0), crntCol.a);
 }
 
+// Weight of a fragment of the given opacity, falling with depth so that nearer surfaces dominate the 
+// weighted average (McGuire and Bavoil 2013).
+float oit_weight(float a)
+{
+  float z = 1.0 - 0.9 * gl_FragCoord.z;
+  return clamp(pow(min(1.0, a * 10.0) + 0.01, 3.0) * 1e8 * z * z * z, 1e-2, 3e3);
+}
+
 void main()
 {
   FragColor = iterate_over_lights();
+  if (orderIndependent) {
+    float w = FragColor.a * oit_weight(FragColor.a);
+    FragColor = vec4(FragColor.rgb * w, FragColor.a);
+    FragWeight = vec4(w);
+  }
 }
\ No newline at end of file
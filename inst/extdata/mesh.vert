@@ -3,16 +3,25 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec4 aColor;
+layout (location = 3) in vec3 objPos;
+layout (location = 4) in vec4 objQuat;
+layout (location = 5) in int aCell;
 
 out vec3 crntPos;
 out vec3 normal;
 out vec4 crntCol;
+out vec4 clipPos;
 
-uniform vec4 objQuat;
-uniform vec3 objPos;
-uniform vec4 camQuat;
-uniform vec3 camPos;
-uniform mat4 projMat;
+layout (std140) uniform Camera
+{
+  mat4 projMat;
+  vec4 camPos;
+  vec4 camQuat;
+};
+
+// Time steps of an animated mesh, one layer each, with cells wrapped onto rows.
+uniform sampler2DArray animationColors;
+uniform int animationLayer; // -1 if the mesh is not animated
 
 vec3 rotate(vec3 position, vec4 quaternion)
 {
@@ -31,6 +40,11 @@ void main()
     normal = rotate(aNormal, objQuat);
     crntPos = rotate(aPos, objQuat) + objPos;
     crntCol = aColor;
-    vec3 pos = rotate(crntPos - camPos, conjugate(camQuat));
+    if (animationLayer >= 0) {
+      int width = textureSize(animationColors, 0).x;
+      crntCol = texelFetch(animationColors, ivec3(aCell % width, aCell / width, animationLayer), 0);
+    }
+    vec3 pos = rotate(crntPos - camPos.xyz, conjugate(camQuat));
     gl_Position = projMat * vec4(pos, 1.0);
-}
\ No newline at end of file
+    clipPos = gl_Position;
+}
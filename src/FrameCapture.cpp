@@ -0,0 +1,98 @@
+#include "FrameCapture.h"
+#include "FrameScheduler.h"
+
+#include <cstring>
+
+void FrameCapture::Capture(const char* filepath, int width, int height, int tag) {
+  Slot& slot = slots[next];
+  next = (next + 1) % slots.size();
+  if (slot.busy) Retire(slot);
+  
+  GLsizeiptr size = 3 * width * height;
+  if (slot.pbo == 0) glGenBuffers(1, &slot.pbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  if (slot.size != size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    slot.size = size;
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  
+  slot.busy = true;
+  slot.filepath = filepath;
+  slot.index = n_captured++;
+  slot.width = width;
+  slot.height = height;
+  slot.tag = tag;
+}
+
+void FrameCapture::Retire(Slot& slot) {
+  int height = slot.height;
+  size_t stride = 3 * slot.width;
+  std::shared_ptr<Frame> frame(new Frame{slot.index, slot.filepath, slot.width, height, {}});
+  frame->pixels.resize(slot.size);
+  
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  const unsigned char* mapped = (const unsigned char*) glMapBufferRange(
+    GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT
+  );
+  if (mapped != NULL) {
+    // OpenGL rows run bottom to top: flip while copying out of the buffer.
+    for (int row = 0; row < height; row++) {
+      std::memcpy(frame->pixels.data() + row * stride, mapped + (height - 1 - row) * stride, stride);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot.busy = false;
+  
+  if (!pool) pool.reset(new ThreadPool());
+  std::shared_ptr<FrameSink> target = sink;
+  int tag = slot.tag;
+  // Bound the number of frames held in memory awaiting the sink.
+  pool->Submit([this, target, frame, tag] {
+    double start = FrameScheduler::Now();
+    target->Write(*frame);
+    if (tag < 0) return;
+    std::lock_guard<std::mutex> lock(writeTimesMutex);
+    writeTimes.push_back(std::make_pair(tag, FrameScheduler::Now() - start));
+  }, 2 * pool->Size());
+}
+
+void FrameCapture::SetSink(FrameSink* new_sink) {
+  Finish();
+  sink.reset(new_sink);
+  n_captured = 0;
+}
+
+void FrameCapture::Wait() {
+  for (size_t i = 0; i < slots.size(); i++) {
+    Slot& slot = slots[(next + i) % slots.size()];
+    if (slot.busy) Retire(slot);
+  }
+  if (pool) pool->Wait();
+}
+
+std::vector<std::pair<int, double> > FrameCapture::TakeWriteTimes() {
+  std::lock_guard<std::mutex> lock(writeTimesMutex);
+  std::vector<std::pair<int, double> > taken;
+  taken.swap(writeTimes);
+  return taken;
+}
+
+void FrameCapture::Finish() {
+  Wait();
+  sink->Close();
+  sink.reset(new PngSink());
+  n_captured = 0;
+}
+
+void FrameCapture::Delete() {
+  Finish();
+  for (Slot& slot : slots) {
+    if (slot.pbo != 0) glDeleteBuffers(1, &slot.pbo);
+    slot.pbo = 0;
+    slot.size = 0;
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef FRAME_CAPTURE
+#define FRAME_CAPTURE
+
+#include <glad/glad.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ThreadPool.h"
+#include "FrameSink.h"
+
+// Asynchronous readback of rendered frames to a FrameSink, PNG files by default.
+// Each frame is read into the next of a ring of pixel buffer objects without 
+// waiting for the transfer. A buffer is only mapped when the ring wraps back 
+// around to it, and its pixels are then passed to the sink on a thread pool.
+class FrameCapture {
+public:
+  
+  FrameCapture(int ring_size = 3) : slots(ring_size), sink(new PngSink()) {}
+  
+  // Start reading the current read buffer into the ring, to be saved to filepath.
+  // Blocks only if the oldest frame in the ring has not yet been transferred.
+  // The time taken to write it is recorded under tag, if not negative.
+  void Capture(const char* filepath, int width, int height, int tag = -1);
+  
+  // Write every frame still in the ring and wait for all sink writes to finish, 
+  // leaving the sink open.
+  void Wait();
+  
+  // Tags and seconds spent writing the tagged frames written since the last call.
+  std::vector<std::pair<int, double> > TakeWriteTimes();
+  
+  // Finish any frames in flight, then send later frames to sink, taking ownership.
+  void SetSink(FrameSink* sink);
+  
+  // Write every frame still in the ring, wait for all sink writes to finish 
+  // and close the sink. Later frames go to PNG files.
+  void Finish();
+  
+  void Delete();
+  
+private:
+  
+  struct Slot {
+    GLuint pbo = 0;
+    GLsizeiptr size = 0;
+    bool busy = false;
+    std::string filepath;
+    size_t index = 0;
+    int width = 0, height = 0;
+    int tag = -1;
+  };
+  
+  // Map a slot's pixel buffer, hand its pixels to the encoder and free the slot.
+  void Retire(Slot& slot);
+  
+  std::vector<Slot> slots;
+  size_t next = 0;
+  size_t n_captured = 0;
+  std::shared_ptr<FrameSink> sink;  // shared with queued writes
+  std::unique_ptr<ThreadPool> pool;  // started on the first retired frame
+  std::mutex writeTimesMutex;
+  std::vector<std::pair<int, double> > writeTimes;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "FrameProfiler.h"
+#include "FrameScheduler.h"
+
+#include <algorithm>
+
+static const char* PHASE_NAMES[N_PHASES] = {"draw", "present", "capture", "step", "upload", "behaviors", "wait"};
+static const char* PASS_NAMES[N_PASSES] = {"gpu_opaque", "gpu_blended", "gpu_capture"};
+static const char* COUNTER_NAMES[N_COUNTERS] = {"draw_calls", "triangles", "uploaded_bytes"};
+
+FrameProfiler::FrameProfiler() : running(false), lastMark(0) {}
+
+void FrameProfiler::Start() {
+  Collect(true);
+  rows.clear();
+  running = true;
+}
+
+void FrameProfiler::StartFrame() {
+  if (!running) return;
+  Collect(false);
+  Row row;
+  std::fill(row.phases, row.phases + N_PHASES, 0.0);
+  row.encode = 0;
+  std::fill(row.passes, row.passes + N_PASSES, NA_REAL);
+  std::fill(row.counts, row.counts + N_COUNTERS, 0.0);
+  rows.push_back(row);
+  lastMark = FrameScheduler::Now();
+}
+
+void FrameProfiler::Mark(int phase) {
+  if (!running || rows.empty()) return;
+  double now = FrameScheduler::Now();
+  rows.back().phases[phase] += now - lastMark;
+  lastMark = now;
+}
+
+void FrameProfiler::BeginPass(int pass) {
+  if (!running || rows.empty()) return;
+  Query query = {0, rows.size() - 1, pass};
+  if (spare.empty()) {
+    glGenQueries(1, &query.id);
+  } else {
+    query.id = spare.back();
+    spare.pop_back();
+  }
+  glBeginQuery(GL_TIME_ELAPSED, query.id);
+  pending.push_back(query);
+}
+
+void FrameProfiler::EndPass() {
+  if (!running || rows.empty()) return;
+  glEndQuery(GL_TIME_ELAPSED);
+}
+
+void FrameProfiler::Count(int counter, double n) {
+  if (!running || rows.empty()) return;
+  rows.back().counts[counter] += n;
+}
+
+void FrameProfiler::AddEncode(int frame, double seconds) {
+  if (frame >= 1 && frame <= (int) rows.size()) rows[frame - 1].encode += seconds;
+}
+
+void FrameProfiler::Stop() {
+  Collect(true);
+  running = false;
+}
+
+void FrameProfiler::Collect(bool wait) {
+  while (!pending.empty()) {
+    Query query = pending.front();
+    GLint available = GL_TRUE;
+    if (!wait) glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return;
+    GLuint64 nanoseconds;
+    glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &nanoseconds);
+    double& seconds = rows[query.row].passes[query.pass];
+    seconds = (ISNAN(seconds) ? 0 : seconds) + nanoseconds * 1e-9;
+    spare.push_back(query.id);
+    pending.pop_front();
+  }
+}
+
+Rcpp::DataFrame FrameProfiler::Table() const {
+  Rcpp::List columns;
+  Rcpp::IntegerVector frames(rows.size());
+  for (size_t r = 0; r < rows.size(); r++) frames[r] = r + 1;
+  columns.push_back(frames, "frame");
+  for (int p = 0; p < N_PHASES; p++) {
+    Rcpp::NumericVector column(rows.size());
+    for (size_t r = 0; r < rows.size(); r++) column[r] = rows[r].phases[p];
+    columns.push_back(column, PHASE_NAMES[p]);
+  }
+  Rcpp::NumericVector encode(rows.size());
+  for (size_t r = 0; r < rows.size(); r++) encode[r] = rows[r].encode;
+  columns.push_back(encode, "encode");
+  for (int p = 0; p < N_PASSES; p++) {
+    Rcpp::NumericVector column(rows.size());
+    for (size_t r = 0; r < rows.size(); r++) column[r] = rows[r].passes[p];
+    columns.push_back(column, PASS_NAMES[p]);
+  }
+  for (int c = 0; c < N_COUNTERS; c++) {
+    Rcpp::NumericVector column(rows.size());
+    for (size_t r = 0; r < rows.size(); r++) column[r] = rows[r].counts[c];
+    columns.push_back(column, COUNTER_NAMES[c]);
+  }
+  return Rcpp::DataFrame(columns);
+}
+
+void FrameProfiler::Delete() {
+  Collect(true);
+  if (!spare.empty()) glDeleteQueries(spare.size(), spare.data());
+  spare.clear();
+}
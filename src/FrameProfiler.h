@@ -0,0 +1,77 @@
+#ifndef FRAME_PROFILER
+#define FRAME_PROFILER
+
+#include <glad/glad.h>
+#include <deque>
+#include <vector>
+#include "Rcpp.h"
+
+// Phases of a frame of GLRenderer::Run(), timed on the CPU.
+enum FramePhase { PHASE_DRAW, PHASE_PRESENT, PHASE_CAPTURE, PHASE_STEP, PHASE_UPLOAD, PHASE_BEHAVIORS, PHASE_WAIT, 
+                  N_PHASES };
+
+// Passes of a frame timed on the GPU.
+enum GpuPass { PASS_OPAQUE, PASS_BLENDED, PASS_CAPTURE, N_PASSES };
+
+// Work counted over a frame.
+enum FrameCounter { COUNT_DRAW_CALLS, COUNT_TRIANGLES, COUNT_UPLOADED_BYTES, N_COUNTERS };
+
+// Where the time of each frame of a run goes. The CPU time of a frame is split between phases by Mark(), 
+// each taking the time since the one before. GPU passes are timed by GL_TIME_ELAPSED queries, which finish 
+// in order a few frames later: they are polled at the start of each frame and only read once available, 
+// so the pipeline is never stalled for them until Stop().
+class FrameProfiler {
+public:
+  FrameProfiler();
+  
+  // Forget earlier frames and time those started from now on.
+  void Start();
+  
+  // Start the next frame. Its phases are marked from now.
+  void StartFrame();
+  
+  // Add the time since the last mark to phase of the current frame. Does nothing outside a run, 
+  // so that methods called from R can mark their phase unconditionally.
+  void Mark(int phase);
+  
+  // Time the GPU commands issued from now until EndPass() as pass of the current frame.
+  // Passes cannot overlap.
+  void BeginPass(int pass);
+  void EndPass();
+  
+  void Count(int counter, double n);
+  
+  // Add seconds spent encoding captures of frame, counted from 1, on worker threads.
+  void AddEncode(int frame, double seconds);
+  
+  // Wait for the queries still in flight and stop timing.
+  void Stop();
+  
+  // One row per frame: its number, CPU seconds by phase, seconds encoding its captures, 
+  // GPU seconds by pass (NA if not run) and counters.
+  Rcpp::DataFrame Table() const;
+  
+  void Delete();
+  
+private:
+  struct Row {
+    double phases[N_PHASES], encode, passes[N_PASSES], counts[N_COUNTERS];
+  };
+  
+  struct Query {
+    GLuint id;
+    size_t row;
+    int pass;
+  };
+  
+  // Read the results of finished queries in order, waiting for each if wait.
+  void Collect(bool wait);
+  
+  bool running;
+  double lastMark;
+  std::vector<Row> rows;
+  std::deque<Query> pending;  // issued, in order
+  std::vector<GLuint> spare;  // query objects free to reuse
+};
+
+#endif
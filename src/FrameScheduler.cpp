@@ -0,0 +1,60 @@
+#include "FrameScheduler.h"
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+
+// Sleeps end this long before a frame is due; the rest is spun away.
+const double SPIN_SECONDS = 0.002;
+
+FrameScheduler::FrameScheduler() : interval(0), due(0), last(0), dropped(0) {}
+
+void FrameScheduler::Start(double framerate) {
+  interval = framerate > 0 && std::isfinite(framerate) ? 1 / framerate : 0;
+  last = Now();
+  due = last + interval;
+  dropped = 0;
+  frameTimes.clear();
+}
+
+void FrameScheduler::Wait() {
+  if (interval > 0) {
+    double remaining = due - Now();
+    if (remaining > SPIN_SECONDS) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(remaining - SPIN_SECONDS));
+    }
+    while (Now() < due) std::this_thread::yield();
+  }
+  double now = Now();
+  frameTimes.push_back(now - last);
+  last = now;
+  if (interval == 0) return;
+  if (now - due > interval / 2) {
+    dropped++;
+    due = now;
+  }
+  due += interval;
+}
+
+double FrameScheduler::Now() {
+  // glfwGetTime() is unavailable when rendering without GLFW.
+  std::chrono::duration<double> time = std::chrono::steady_clock::now().time_since_epoch();
+  return time.count();
+}
+
+#ifdef _WIN32
+
+TimerResolution::TimerResolution() { timeBeginPeriod(1); }
+TimerResolution::~TimerResolution() { timeEndPeriod(1); }
+
+#else
+
+TimerResolution::TimerResolution() {}
+TimerResolution::~TimerResolution() {}
+
+#endif
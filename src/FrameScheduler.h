@@ -0,0 +1,49 @@
+#ifndef FRAME_SCHEDULER
+#define FRAME_SCHEDULER
+
+#include <vector>
+
+// Paces frames to a target rate without holding a CPU core. Each frame sleeps until shortly before it is
+// due, since sleeps can overshoot by a scheduler tick, then yields in a short spin for the rest. A frame
+// that finishes more than half an interval late is counted as dropped, and the next is timed from it
+// rather than hurried to catch up. The time between successive frames is recorded either way.
+// Windows sleeps in ticks of about 15.6 ms by default, so frames should be paced within the lifetime of
+// a TimerResolution.
+class FrameScheduler {
+public:
+  FrameScheduler();
+
+  // Aim for framerate frames per second from now on, or as many as can be drawn if it is infinite.
+  void Start(double framerate);
+
+  // Wait until the next frame is due, then record the time since the last.
+  void Wait();
+
+  // Seconds between successive frames since Start().
+  const std::vector<double>& FrameTimes() const { return frameTimes; }
+
+  // Frames since Start() that took more than one and a half intervals.
+  int Dropped() const { return dropped; }
+
+  // Seconds on a monotonic clock.
+  static double Now();
+
+private:
+  double interval, due, last;
+  int dropped;
+  std::vector<double> frameTimes;
+};
+
+// Raises the resolution of the system timer to 1 ms while in scope on Windows, where sleeps would
+// otherwise overshoot by most of an interval. Does nothing elsewhere.
+class TimerResolution {
+public:
+  TimerResolution();
+  ~TimerResolution();
+
+private:
+  TimerResolution(const TimerResolution&);
+  TimerResolution& operator=(const TimerResolution&);
+};
+
+#endif
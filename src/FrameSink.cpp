@@ -0,0 +1,38 @@
+#include "FrameSink.h"
+
+#include "GifEncoder.h"
+#include "stb_image_write.h"
+
+void PngSink::Write(const Frame& frame) {
+  stbi_write_png(frame.filepath.c_str(), frame.width, frame.height, 3, frame.pixels.data(), 3 * frame.width);
+}
+
+GifSink::GifSink(const char* filepath, int delay, int loop) : delay(delay), loop(loop) {
+  file = std::fopen(filepath, "wb");
+}
+
+GifSink::~GifSink() {
+  Close();
+}
+
+void GifSink::Write(const Frame& frame) {
+  std::vector<unsigned char> bytes;
+  if (frame.index == 0) bytes = GifHeader(frame.width, frame.height, loop);
+  std::vector<unsigned char> image = GifFrame(frame.pixels.data(), frame.width, frame.height, delay);
+  bytes.insert(bytes.end(), image.begin(), image.end());
+  
+  std::lock_guard<std::mutex> lock(mutex);
+  encoded[frame.index].swap(bytes);
+  // Append every frame that is now next in line.
+  for (auto it = encoded.begin(); it != encoded.end() && it->first == nextIndex; it = encoded.erase(it)) {
+    if (file != NULL) std::fwrite(it->second.data(), 1, it->second.size(), file);
+    nextIndex++;
+  }
+}
+
+void GifSink::Close() {
+  if (file == NULL) return;
+  std::fputc(GIF_TRAILER, file);
+  std::fclose(file);
+  file = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef FRAME_SINK
+#define FRAME_SINK
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A captured frame: RGB pixels, top row first.
+struct Frame {
+  size_t index;          // order of capture since the sink was set
+  std::string filepath;  // as passed to GLRenderer::SaveImage
+  int width, height;
+  std::vector<unsigned char> pixels;
+};
+
+// Destination of captured frames. Write() is called on worker threads, 
+// possibly concurrently and out of order.
+class FrameSink {
+public:
+  virtual ~FrameSink() {}
+  virtual void Write(const Frame& frame) = 0;
+  
+  // Called once every captured frame has been written.
+  virtual void Close() {}
+};
+
+// Each frame to its own PNG file at the frame's filepath.
+class PngSink : public FrameSink {
+public:
+  void Write(const Frame& frame);
+};
+
+// Every frame to one GIF file. Frames are quantized and compressed in 
+// parallel, then appended in capture order. delay is in hundredths of a 
+// second; see GifHeader() for loop.
+class GifSink : public FrameSink {
+public:
+  GifSink(const char* filepath, int delay, int loop);
+  ~GifSink();
+  bool IsOpen() const { return file != NULL; }
+  void Write(const Frame& frame);
+  void Close();
+  
+private:
+  FILE* file;
+  int delay, loop;
+  size_t nextIndex = 0;
+  std::map<size_t, std::vector<unsigned char>> encoded;  // finished out of order
+  std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef FRUSTUM
+#define FRUSTUM
+
+#include <cmath>
+#include "Quaternion.h"
+
+// View frustum as six planes (a, b, c, d), with a x + b y + c z + d >= 0 on the inside
+// and (a, b, c) of unit length, in the coordinates of some frame.
+struct Frustum {
+  double planes[6][4];
+
+  Frustum() {}
+
+  // Frustum of a column-major projection matrix, in the coordinates of the camera.
+  explicit Frustum(const float* m) {
+    // Left, right, bottom, top, near and far planes are the last row of the matrix plus or minus another row.
+    for (int p = 0; p < 6; p++) {
+      int row = p / 2;
+      double sign = p % 2 == 0 ? 1 : -1;
+      double length = 0;
+      for (int c = 0; c < 4; c++) {
+        planes[p][c] = m[4 * c + 3] + sign * m[4 * c + row];
+        if (c < 3) length += planes[p][c] * planes[p][c];
+      }
+      length = std::sqrt(length);
+      for (int c = 0; c < 4; c++) planes[p][c] /= length;
+    }
+  }
+
+  // The same frustum in the coordinates of the parent of this frame, in which
+  // this frame is placed at position p with orientation q (w, x, y, z).
+  Frustum ToParent(const double* p, const double* q) const {
+    Frustum out;
+    for (int i = 0; i < 6; i++) {
+      QRotate(q, planes[i], out.planes[i]);
+      out.planes[i][3] = planes[i][3] - Dot(out.planes[i], p);
+    }
+    return out;
+  }
+
+  // The same frustum in the coordinates of a child frame placed at position p with orientation q.
+  Frustum ToChild(const double* p, const double* q) const {
+    const double inverse[4] = {q[0], -q[1], -q[2], -q[3]};
+    Frustum out;
+    for (int i = 0; i < 6; i++) {
+      QRotate(inverse, planes[i], out.planes[i]);
+      out.planes[i][3] = planes[i][3] + Dot(planes[i], p);
+    }
+    return out;
+  }
+
+  // Whether any of the sphere may be inside the frustum.
+  bool Sees(const double* center, double radius) const {
+    for (int i = 0; i < 6; i++) {
+      if (Dot(planes[i], center) + planes[i][3] < -radius) return false;
+    }
+    return true;
+  }
+
+  static double Dot(const double* a, const double* b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+  }
+};
+
+// Number of things drawn and culled by frustum tests.
+struct CullStats {
+  double drawn = 0, culled = 0;
+};
+
+#endif
@@ -3,6 +3,12 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include "Quaternion.h"
 
 // #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
@@ -11,7 +17,14 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-GLRenderer::GLRenderer(const char* window_name, int width, int height) {
+GLRenderer::GLRenderer(const char* window_name, int width, int height)
+  : GLRenderer(window_name, width, height, false) {}
+
+GLRenderer::GLRenderer(const char* window_name, int width, int height, bool headless)
+  : window(NULL), headless(headless), vertexLayout(VERTEX_COMPACT) {
+  if (headless) {
+    InitOffscreen(width, height);
+  } else {
     // Initialize GLFW
     glfwInit();
 
@@ -29,17 +42,59 @@ GLRenderer::GLRenderer(const char* window_name, int width, int height) {
         glfwTerminate();
         // exit(-1);
     }
+  }
 
-    double prevTime = glfwGetTime();
-    (void) prevTime;
+  glEnable(GL_PROGRAM_POINT_SIZE);
     
-    glEnable(GL_PROGRAM_POINT_SIZE);
+  glEnable(GL_DEPTH_TEST);
+  // glDepthMask(GL_FALSE);
     
-    glEnable(GL_DEPTH_TEST);
-    // glDepthMask(GL_FALSE);
-    
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void GLRenderer::InitOffscreen(int width, int height) {
+  if (offscreenContext.Create()) {
+    gladLoadGLLoader((GLADloadproc)OffscreenContext::GetProcAddress);
+  } else {
+    // No EGL: use an invisible GLFW window, which still needs a window system.
+    glfwInit();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    window = glfwCreateWindow(width, height, "", NULL, NULL);
+    if (window == NULL) {
+      glfwTerminate();
+      Rcpp::stop("could not create an offscreen OpenGL context");
+    }
+    glfwMakeContextCurrent(window);
+    gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+  }
+  
+  InitFramebuffer(width, height);
+  glViewport(0, 0, width, height);
+}
+
+void GLRenderer::InitFramebuffer(int width, int height) {
+  if (framebuffer == 0) {
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &colorbuffer);
+    glGenRenderbuffers(1, &depthbuffer);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  if (width == framebufferWidth && height == framebufferHeight) return;
+  
+  glBindRenderbuffer(GL_RENDERBUFFER, colorbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorbuffer);
+  
+  glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+  
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    Rcpp::Rcout << "ERROR: OFFSCREEN FRAMEBUFFER INCOMPLETE" << std::endl;
+  }
+  framebufferWidth = width;
+  framebufferHeight = height;
 }
 
 void CompileErrors(unsigned int shader, const char* type) {
@@ -61,7 +116,7 @@ void CompileErrors(unsigned int shader, const char* type) {
   }
 }
 
-void GLRenderer::InitMeshShaderProgram(const char* vertex_shader, const char* fragment_shader) {
+GLuint GLRenderer::CompileShaderProgram(const char* vertex_shader, const char* fragment_shader) {
   // Set up vertex shader
   std::string vertex_code = GetFileContents(vertex_shader);
   const char* vertex_source = vertex_code.c_str();
@@ -79,26 +134,133 @@ void GLRenderer::InitMeshShaderProgram(const char* vertex_shader, const char* fr
   CompileErrors(fragmentShader, "FRAGMENT");
   
   // Link shaders into a program
-  meshShaderProgram = glCreateProgram();
-  glAttachShader(meshShaderProgram, vertexShader);
-  glAttachShader(meshShaderProgram, fragmentShader);
-  glLinkProgram(meshShaderProgram);
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertexShader);
+  glAttachShader(program, fragmentShader);
+  glLinkProgram(program);
   
   // Delete shaders (we no longer need them after linking)
   glDeleteShader(vertexShader);
   glDeleteShader(fragmentShader);
+  return program;
+}
+
+void GLRenderer::InitMeshShaderProgram(const char* vertex_shader, const char* fragment_shader) {
+  meshShaderProgram = CompileShaderProgram(vertex_shader, fragment_shader);
+  glUniformBlockBinding(meshShaderProgram, glGetUniformBlockIndex(meshShaderProgram, "Camera"), CAMERA_BINDING);
+  glUniformBlockBinding(meshShaderProgram, glGetUniformBlockIndex(meshShaderProgram, "Lights"), LIGHTS_BINDING);
+  animationLayerLocation = glGetUniformLocation(meshShaderProgram, "animationLayer");
+  orderIndependentLocation = glGetUniformLocation(meshShaderProgram, "orderIndependent");
+  InitBuffers();
+  lightClusters.Init(meshShaderProgram);
+}
+
+void GLRenderer::InitCompositeShaderProgram(const char* vertex_shader, const char* fragment_shader) {
+  transparency.Init(CompileShaderProgram(vertex_shader, fragment_shader));
+}
+
+void GLRenderer::InitBuffers() {
+  // Both blocks share one buffer so that a frame's camera and lights are sent together.
+  GLint alignment;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  lightsOffset = (sizeof(CameraBlock) + alignment - 1) / alignment * alignment;
+  uniformData.assign(lightsOffset + sizeof(LightsBlock), 0);
+  
+  glGenBuffers(1, &uniformBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, uniformData.size(), uniformData.data(), GL_DYNAMIC_DRAW);
+  glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BINDING, uniformBuffer, 0, sizeof(CameraBlock));
+  glBindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BINDING, uniformBuffer, lightsOffset, sizeof(LightsBlock));
+  
+  glGenBuffers(1, &instanceBuffer);
+  instanceBufferSize = 0;
+}
+
+void GLRenderer::UploadUniforms(size_t from, size_t to) {
+  glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, from, to - from, uniformData.data() + from);
+  profiler.Count(COUNT_UPLOADED_BYTES, to - from);
+}
+
+void GLRenderer::UploadInstances() {
+  size_t size = instanceData.size() * sizeof(float);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  if (size > instanceBufferSize) {
+    instanceBufferSize = std::max(size, 2 * instanceBufferSize);
+  }
+  // Orphan the previous frame's instances rather than wait for draws reading them.
+  glBufferData(GL_ARRAY_BUFFER, instanceBufferSize, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, size, instanceData.data());
+  profiler.Count(COUNT_UPLOADED_BYTES, size);
+}
+
+void GLRenderer::CountDraws(int count, const std::vector<GLsizei>& ranges) {
+  double indices = 0;
+  for (size_t r = 1; r < ranges.size(); r += 2) indices += ranges[r];
+  profiler.Count(COUNT_DRAW_CALLS, ranges.size() / 2);
+  profiler.Count(COUNT_TRIANGLES, (double) count * indices / 3);
 }
 
 void GLRenderer::UseMeshShaderProgram() {
   glUseProgram(meshShaderProgram);
 }
 
-void GLRenderer::InitMesh(std::vector<float>& vertices, std::vector<GLuint>& indices) {
-  meshes.push_back(Mesh(vertices, indices));
+void GLRenderer::InitMesh(Rcpp::NumericVector vertices, Rcpp::IntegerVector indices) {
+  meshes.push_back(Mesh(vertices.begin(), vertices.size() / 10, indices.begin(), indices.size(), vertexLayout));
+}
+
+void GLRenderer::InitAnimatedMesh(Rcpp::NumericVector vertices, Rcpp::IntegerVector indices, std::vector<int>& color_columns) {
+  meshes.push_back(Mesh(vertices.begin(), vertices.size() / 10, indices.begin(), indices.size(), vertexLayout, color_columns));
+}
+
+void GLRenderer::InitTerrain(Rcpp::NumericMatrix relief, Rcpp::NumericVector geotransform, Rcpp::NumericMatrix corners, 
+                             bool globe, double radius, Rcpp::NumericMatrix color, double tolerance, bool animated) {
+  RasterGrid grid = MakeRasterGrid(relief, geotransform, corners, globe, radius);
+  std::vector<float> vertices;
+  std::vector<GLuint> indices;
+  std::vector<int> color_columns;
+  Terrain terrain(grid, color.begin(), color.nrow(), color.ncol(), tolerance, vertices, indices, color_columns);
+  terrains[meshes.size()] = terrain;
+  if (!animated) color_columns.clear();
+  meshes.push_back(Mesh(vertices, indices, vertexLayout, color_columns));
+}
+
+void GLRenderer::InitCachedMesh(std::string filename) {
+  MappedFile file(filename);
+  const MeshCacheHeader& header = CheckMeshCache(file, filename);
+  const unsigned char* data = file.Data();
+  const int32_t* columns = (const int32_t*) (data + header.offsets[CACHE_COLOR_COLUMNS]);
+  std::vector<int> color_columns(columns, columns + header.sizes[CACHE_COLOR_COLUMNS] / sizeof(int32_t));
+  meshes.push_back(Mesh(data + header.offsets[CACHE_VERTICES], header.n_vertices, data + header.offsets[CACHE_INDICES],
+                        header.n_indices, header.index_type, header.layout, data + header.offsets[CACHE_COLORS],
+                        color_columns, header.center, header.radius));
+  if (header.n_tiles > 0) {
+    terrains[meshes.size() - 1] = Terrain((const TerrainTile*) (data + header.offsets[CACHE_TILES]), header.n_tiles,
+                                          header.tolerance);
+  }
+  if (header.n_frames > 0) meshes.back().InitAnimation(data + header.offsets[CACHE_ANIMATION], header.n_cells, header.n_frames);
+}
+
+void GLRenderer::UpdateMeshColors(int i, Rcpp::NumericMatrix color) {
+  profiler.Mark(PHASE_STEP);
+  profiler.Count(COUNT_UPLOADED_BYTES, meshes[i].UpdateColors(color.begin(), color.nrow(), color.ncol()));
+  profiler.Mark(PHASE_UPLOAD);
+}
+
+void GLRenderer::SetMeshAnimation(int i, Rcpp::RawVector colors, int n_cells, int n_frames) {
+  if ((double) colors.size() != 4.0 * n_cells * n_frames) Rcpp::stop("colors must have dimensions (4, n_cells, n_frames)");
+  meshes[i].InitAnimation(colors.begin(), n_cells, n_frames);
+}
+
+void GLRenderer::SetVertexLayout(int layout) {
+  vertexLayout = layout;
 }
 
-void GLRenderer::UpdateMeshBuffer(int i, std::vector<float>& vertices) {
-  meshes[i].UpdateArrayBuffer(vertices);
+void GLRenderer::UpdateMeshBuffer(int i, Rcpp::NumericVector vertices) {
+  // Time spent in R before the upload, unpacking the mesh among other things, counts as the step's.
+  profiler.Mark(PHASE_STEP);
+  profiler.Count(COUNT_UPLOADED_BYTES, meshes[i].UpdateArrayBuffer(vertices.begin(), vertices.size() / 10));
+  profiler.Mark(PHASE_UPLOAD);
 }
 
 void GLRenderer::Clear() {
@@ -106,16 +268,23 @@ void GLRenderer::Clear() {
 }
 
 void GLRenderer::DrawMesh(int i, Rcpp::NumericVector p, Rcpp::NumericVector q) {
-  meshes[i].Draw(meshShaderProgram, p, q);
+  const float instance[INSTANCE_FLOATS] = {(float) p[0], (float) p[1], (float) p[2], 
+                                           (float) q[1], (float) q[2], (float) q[3], (float) q[0]};
+  instanceData.assign(instance, instance + INSTANCE_FLOATS);
+  UploadInstances();
+  glUniform1i(animationLayerLocation, meshes[i].IsAnimated() ? 0 : -1);
+  meshes[i].Draw(instanceBuffer, 0, 1);
 }
 
 void GLRenderer::Update() {
-  glfwSwapBuffers(window);
+  if (window == NULL) return;
+  if (!headless) glfwSwapBuffers(window);
   glfwPollEvents();
 }
 
 std::vector<int> GLRenderer::GetInputs() {
   std::vector<int> output;
+  if (headless) return output;
   for (int i = GLFW_KEY_SPACE; i <= GLFW_KEY_LAST; i++) {
     if (glfwGetKey(window, i)) {
       output.push_back(i);
@@ -124,20 +293,25 @@ std::vector<int> GLRenderer::GetInputs() {
   return output;
 }
 
-void GLRenderer::FramerateLimit(int framerate) {
-  double currTime = glfwGetTime();
-  while (currTime - prevTime <= 1.0 / framerate) {
-    currTime = glfwGetTime();
-  }
-  prevTime = currTime;
-}
-
 void GLRenderer::Delete() {
-  for (Mesh mesh : meshes) mesh.Delete();
+  frameCapture.Delete();
+  for (Mesh& mesh : meshes) mesh.Delete();
+  glDeleteBuffers(1, &uniformBuffer);
+  glDeleteBuffers(1, &instanceBuffer);
+  lightClusters.Delete();
+  transparency.Delete();
+  profiler.Delete();
   glDeleteProgram(meshShaderProgram);
   
+  if (framebuffer != 0) {
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorbuffer);
+    glDeleteRenderbuffers(1, &depthbuffer);
+  }
+  if (headless) offscreenContext.Delete();
+  
   // Terminate GLFW
-  glfwTerminate();
+  if (window != NULL) glfwTerminate();
 }
 
 std::string GLRenderer::GetFileContents(const char* filename) {
@@ -158,32 +332,386 @@ std::string GLRenderer::GetFileContents(const char* filename) {
 }
 
 void GLRenderer::SetLights(std::vector<float> lightdata) {
-  int data_size = lightdata.size();
-  int nlights = data_size / 9;
-  glUniform1fv(glGetUniformLocation(meshShaderProgram, "lightArray"), data_size, lightdata.data());
-  glUniform1i(glGetUniformLocation(meshShaderProgram, "nlights"), nlights);
+  WriteLights(lightdata);
+  AssignLights();
+  UploadUniforms(lightsOffset, uniformData.size());
 }
 
 void GLRenderer::SetCamera(Rcpp::NumericVector p, Rcpp::NumericVector q, float FOVdeg, float aspect) {
-  glUniform3f(glGetUniformLocation(meshShaderProgram, "camPos"), p[0], p[1], p[2]);
-  glUniform4f(glGetUniformLocation(meshShaderProgram, "camQuat"), q[1], q[2], q[3], q[0]);
+  WriteCamera(p.begin(), q.begin(), FOVdeg, aspect);
+  AssignLights();
+  UploadUniforms(0, lightsOffset + offsetof(LightsBlock, lights));
+}
+
+void GLRenderer::WriteLights(const std::vector<float>& lightdata) {
+  LightsBlock* block = (LightsBlock*) &uniformData[lightsOffset];
+  block->nlights = 0;
+  localLights.clear();
+  for (size_t i = 0; i + 10 <= lightdata.size(); i += 10) {
+    const float* light = &lightdata[i];
+    if (std::isnan(light[0]) || !std::isfinite(light[9])) {
+      if (block->nlights == MAX_LIGHTS) continue;
+      for (int j = 0; j < 3; j++) std::copy(light + 3 * j, light + 3 * j + 3, block->lights[3 * block->nlights + j]);
+      block->nlights++;
+      continue;
+    }
+    // A point light has no direction, and a spotlight one.
+    LocalLight local = {{light[0], light[1], light[2]}, light[9], {light[3], light[4], light[5]},
+                        std::isnan(light[3]) ? 0.0f : 1.0f, {light[6], light[7], light[8]}, 0};
+    localLights.push_back(local);
+  }
+}
+
+void GLRenderer::AssignLights() {
+  profiler.Count(COUNT_UPLOADED_BYTES, lightClusters.Assign(localLights, cameraPosition, cameraOrientation));
+  LightsBlock* block = (LightsBlock*) &uniformData[lightsOffset];
+  const int counts[4] = {CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z, lightClusters.Count()};
+  std::copy(counts, counts + 4, block->clusterCounts);
+  block->clusterDepths[0] = lightClusters.Near();
+  block->clusterDepths[1] = lightClusters.SliceScale();
+}
+
+void GLRenderer::WriteCamera(const double* p, const double* q, float FOVdeg, float aspect) {
+  CameraBlock* block = (CameraBlock*) &uniformData[0];
   glm::mat4 projection = glm::perspective(glm::radians(FOVdeg), aspect, 0.1f, 100.0f);
-  glUniformMatrix4fv(glGetUniformLocation(meshShaderProgram, "projMat"), 1, GL_FALSE, glm::value_ptr(projection));
+  frustum = Frustum(glm::value_ptr(projection));
+  lightClusters.SetProjection(FOVdeg, aspect, 0.1, 100);
+  std::copy(p, p + 3, cameraPosition);
+  std::copy(q, q + 4, cameraOrientation);
+  std::memcpy(block->projMat, glm::value_ptr(projection), sizeof(block->projMat));
+  for (int i = 0; i < 3; i++) block->camPos[i] = p[i];
+  for (int i = 0; i < 3; i++) block->camQuat[i] = q[i + 1];
+  block->camQuat[3] = q[0];
 }
 
 bool GLRenderer::WindowShouldClose() {
+  if (headless) return false;
   return glfwWindowShouldClose(window);
 }
 
+void GLRenderer::CaptureFrame(const char* filepath, int width, int height, int frame) {
+  if (headless) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+  } else {
+    glReadBuffer(GL_FRONT);
+  }
+  profiler.BeginPass(PASS_CAPTURE);
+  frameCapture.Capture(filepath, width, height, frame);
+  profiler.EndPass();
+}
+
 void GLRenderer::SaveImage(const char* filepath, int width, int height) {
-  GLsizei nrChannels = 3;
-  GLsizei stride = nrChannels * width;
-  stride += (stride % 4) ? (4 - stride % 4) : 0;
-  GLsizei bufferSize = stride * height;
-  std::vector<char> buffer(bufferSize);
-  glPixelStorei(GL_PACK_ALIGNMENT, 4);
-  glReadBuffer(GL_FRONT);
-  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, buffer.data());
-  stbi_flip_vertically_on_write(true);
-  stbi_write_png(filepath, width, height, nrChannels, buffer.data(), stride);
+  CaptureFrame(filepath, width, height);
+}
+
+void GLRenderer::StartGif(const char* filepath, double delay, int loop) {
+  GifSink* sink = new GifSink(filepath, (int) std::round(delay * 100), loop);
+  if (!sink->IsOpen()) {
+    delete sink;
+    Rcpp::stop("cannot open file '%s'", filepath);
+  }
+  frameCapture.SetSink(sink);
+}
+
+void GLRenderer::SaveFrame(int width, int height) {
+  CaptureFrame("", width, height);
+}
+
+void GLRenderer::FinishImages() {
+  frameCapture.Finish();
+}
+
+void GLRenderer::InitScene(Rcpp::IntegerVector kinds, Rcpp::NumericMatrix positions, Rcpp::NumericMatrix orientations,
+                           Rcpp::NumericMatrix colors, Rcpp::NumericVector fovs, Rcpp::NumericVector ranges, 
+                           Rcpp::IntegerVector meshes, Rcpp::LogicalVector blended) {
+  scene.kinds.assign(kinds.begin(), kinds.end());
+  scene.positions.assign(positions.begin(), positions.end());
+  scene.orientations.assign(orientations.begin(), orientations.end());
+  scene.colors.assign(colors.begin(), colors.end());
+  scene.fovs.assign(fovs.begin(), fovs.end());
+  scene.ranges.assign(ranges.begin(), ranges.end());
+  scene.meshes.assign(meshes.begin(), meshes.end());
+  scene.blended.assign(blended.begin(), blended.end());
+  scene.layers.assign(kinds.size(), 0);
+  scene.behaviors.assign(kinds.size(), std::vector<NativeBehavior>());
+}
+
+void GLRenderer::AddSpin(int i, Rcpp::NumericVector axis, int direction, double angle, bool quit_after_cycle) {
+  NativeBehavior spin;
+  spin.type = NATIVE_SPIN;
+  for (int j = 0; j < 3; j++) spin.axis[j] = direction < 0 ? axis[j] : 0;
+  spin.direction = direction;
+  spin.angle = angle;
+  spin.quit_after_cycle = quit_after_cycle;
+  spin.stop_frame = 360 / angle;
+  scene.behaviors[i].push_back(spin);
+}
+
+void GLRenderer::AddAnimation(int i, int n_frames, bool quit_after_cycle) {
+  NativeBehavior animation;
+  animation.type = NATIVE_ANIMATE;
+  animation.n_frames = n_frames;
+  animation.quit_after_cycle = quit_after_cycle;
+  animation.stop_frame = n_frames + 1;
+  scene.behaviors[i].push_back(animation);
+}
+
+void GLRenderer::SetAnimationFrame(int i, int layer) {
+  scene.layers[i] = layer;
+}
+
+void GLRenderer::SetElement(int i, Rcpp::NumericVector position, Rcpp::NumericVector orientation,
+                            Rcpp::NumericVector color, double fov, double range) {
+  std::copy(position.begin(), position.end(), &scene.positions[3 * i]);
+  std::copy(orientation.begin(), orientation.end(), &scene.orientations[4 * i]);
+  if (color.size() == 3) std::copy(color.begin(), color.end(), &scene.colors[3 * i]);
+  scene.fovs[i] = fov;
+  scene.ranges[i] = range;
+}
+
+Rcpp::NumericMatrix GLRenderer::GetPositions() {
+  return Rcpp::NumericMatrix(3, scene.Size(), scene.positions.begin());
+}
+
+Rcpp::NumericMatrix GLRenderer::GetOrientations() {
+  return Rcpp::NumericMatrix(4, scene.Size(), scene.orientations.begin());
+}
+
+void GLRenderer::DrawScene(int width, int height) {
+  int camera = scene.Camera();
+  double camera_orientation[4];
+  std::copy(&scene.orientations[4 * camera], &scene.orientations[4 * camera + 4], camera_orientation);
+  const double no_axis[3] = {0, 0, 0};
+  RotateOrientation(camera_orientation, no_axis, SKEWER_RIGHT, 180);
+  
+  std::vector<float> lightdata;
+  for (int i = 0; i < scene.Size(); i++) {
+    if (scene.kinds[i] != ELEMENT_LIGHT) continue;
+    double direction[3];
+    Q2Dir(&scene.orientations[4 * i], direction);
+    for (int j = 0; j < 3; j++) lightdata.push_back(scene.positions[3 * i + j]);
+    for (int j = 0; j < 3; j++) lightdata.push_back(direction[j]);
+    for (int j = 0; j < 3; j++) lightdata.push_back(scene.colors[3 * i + j] / 255);
+    lightdata.push_back(scene.ranges[i]);
+  }
+  
+  WriteLights(lightdata);
+  const double* camera_position = &scene.positions[3 * camera];
+  WriteCamera(camera_position, camera_orientation, scene.fovs[camera], (float) width / height);
+  AssignLights();
+  int nlights = ((LightsBlock*) &uniformData[lightsOffset])->nlights;
+  UploadUniforms(0, lightsOffset + offsetof(LightsBlock, lights) + nlights * sizeof(float[3][4]));
+  
+  // Group the instances of each mesh so that every mesh is drawn in one call, and those blended 
+  // order-independently in another after every other mesh: group m + n_meshes for mesh m.
+  // Unplaced or unoriented objects, and those outside the view frustum, cannot be seen.
+  Frustum world = frustum.ToParent(camera_position, camera_orientation);
+  statsFrames++;
+  int n_meshes = meshes.size();
+  std::vector<int> groups(scene.Size(), -1);
+  std::vector<int> first(2 * n_meshes + 1, 0);
+  for (int i = 0; i < scene.Size(); i++) {
+    if (scene.kinds[i] != ELEMENT_OBJECT || !IsVisible(i)) continue;
+    bool drawn = IsInView(i, world);
+    if (drawn) groups[i] = scene.meshes[i] + (scene.blended[i] ? n_meshes : 0);
+    if (drawn) first[groups[i] + 1]++;
+    if (drawn) objectStats.drawn++; else objectStats.culled++;
+  }
+  for (int g = 0; g < 2 * n_meshes; g++) first[g + 1] += first[g];
+  std::vector<int> filled(first.begin(), first.end() - 1);
+  std::vector<int> layers(meshes.size(), -1);
+  bool any_blended = first[2 * n_meshes] > first[n_meshes];
+  
+  instanceData.resize(first.back() * INSTANCE_FLOATS);
+  for (int i = 0; i < scene.Size(); i++) {
+    if (groups[i] < 0) continue;
+    const double* p = &scene.positions[3 * i];
+    const double* q = &scene.orientations[4 * i];
+    if (meshes[scene.meshes[i]].IsAnimated()) layers[scene.meshes[i]] = scene.layers[i];
+    float* instance = &instanceData[filled[groups[i]]++ * INSTANCE_FLOATS];
+    instance[0] = p[0]; instance[1] = p[1]; instance[2] = p[2];
+    instance[3] = q[1]; instance[4] = q[2]; instance[5] = q[3]; instance[6] = q[0];
+  }
+  UploadInstances();
+  
+  // Windows draw into a framebuffer object of their own to share its depth with the blended objects.
+  if (any_blended && !headless) InitFramebuffer(width, height);
+  profiler.BeginPass(PASS_OPAQUE);
+  Clear();
+  int layer = -1;
+  glUniform1i(animationLayerLocation, layer);
+  double pixels_per_unit = height / (2 * std::tan(scene.fovs[camera] * QUATERNION_PI / 360));
+  std::vector<GLsizei> ranges;
+  for (int g = 0; g < 2 * n_meshes; g++) {
+    if (g == n_meshes && any_blended) {
+      profiler.EndPass();
+      profiler.BeginPass(PASS_BLENDED);
+      transparency.Begin(depthbuffer, width, height);
+      glUniform1i(orderIndependentLocation, 1);
+    }
+    int count = first[g + 1] - first[g];
+    if (count == 0) continue;
+    int m = g % n_meshes;
+    if (layers[m] != layer) glUniform1i(animationLayerLocation, layer = layers[m]);
+    std::map<int, Terrain>::iterator terrain = terrains.find(m);
+    if (terrain == terrains.end()) {
+      meshes[m].Draw(instanceBuffer, first[g], count);
+      CountDraws(count, std::vector<GLsizei>{0, meshes[m].IndexCount()});
+      continue;
+    }
+    // Tiles are chosen by the distance of the camera from each instance in the terrain's own coordinates.
+    for (int k = first[g]; k < first[g + 1]; k++) {
+      const float* instance = &instanceData[k * INSTANCE_FLOATS];
+      const double p[3] = {instance[0], instance[1], instance[2]};
+      const double q[4] = {instance[6], instance[3], instance[4], instance[5]};
+      const double inverse[4] = {q[0], -q[1], -q[2], -q[3]};
+      double offset[3], local[3];
+      for (int c = 0; c < 3; c++) offset[c] = camera_position[c] - p[c];
+      QRotate(inverse, offset, local);
+      terrain->second.Select(local, world.ToChild(p, q), pixels_per_unit, ranges, tileStats);
+      meshes[m].DrawRanges(instanceBuffer, k, 1, ranges);
+      CountDraws(1, ranges);
+    }
+  }
+  
+  if (any_blended) {
+    transparency.Composite(framebuffer, meshShaderProgram);
+    glUniform1i(orderIndependentLocation, 0);
+  }
+  if (any_blended && !headless) {
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+  profiler.EndPass();
+}
+
+bool GLRenderer::IsVisible(int i) {
+  return !AnyNaN(&scene.positions[3 * i], 3) && !AnyNaN(&scene.orientations[4 * i], 4);
+}
+
+bool GLRenderer::IsInView(int i, const Frustum& world) {
+  const Mesh& mesh = meshes[scene.meshes[i]];
+  const double* p = &scene.positions[3 * i];
+  double center[3];
+  QRotate(&scene.orientations[4 * i], mesh.Center(), center);
+  for (int c = 0; c < 3; c++) center[c] += p[c];
+  return world.Sees(center, mesh.Radius());
+}
+
+Rcpp::NumericVector GLRenderer::GetStats() {
+  return Rcpp::NumericVector::create(
+    Rcpp::Named("frames") = statsFrames,
+    Rcpp::Named("objects_drawn") = objectStats.drawn,
+    Rcpp::Named("objects_culled") = objectStats.culled,
+    Rcpp::Named("tiles_drawn") = tileStats.drawn,
+    Rcpp::Named("tiles_culled") = tileStats.culled,
+    Rcpp::Named("frames_dropped") = frameScheduler.Dropped()
+  );
+}
+
+// Substitute frame into the integer formats (%d, %05i, ...) of filename as sprintf() would.
+std::string FrameFilename(const std::string& filename, int frame) {
+  std::string out;
+  for (size_t i = 0; i < filename.size(); i++) {
+    if (filename[i] != '%') {
+      out += filename[i];
+      continue;
+    }
+    size_t end = filename.find_first_not_of("-+ #0123456789", i + 1);
+    if (end == std::string::npos) Rcpp::stop("unrecognised format in filename '%s'", filename);
+    char conversion = filename[end];
+    std::string spec = filename.substr(i, end - i);
+    if (conversion == '%' && end == i + 1) {
+      out += '%';
+    } else if (conversion == 'd' || conversion == 'i' || conversion == 's') {
+      char buffer[64];
+      std::snprintf(buffer, sizeof(buffer), (spec + 'd').c_str(), frame);
+      out += buffer;
+    } else {
+      Rcpp::stop("filename '%s' must only contain integer formats", filename);
+    }
+    i = end;
+  }
+  return out;
+}
+
+Rcpp::List GLRenderer::Run(Rcpp::Function step, bool call_step, Rcpp::List inputs, bool interactive,
+                           int width, int height, std::string filename, bool save_frames, bool one_frame, 
+                           double framerate, bool vsync) {
+  if (scene.Camera() < 0) Rcpp::stop("scene must contain a camera");
+  bool save_to_png = !filename.empty();
+  if (save_to_png) FrameFilename(filename, 1);
+  
+  SceneState initial_scene = scene;
+  statsFrames = 0;
+  objectStats = tileStats = CullStats();
+  std::vector<std::vector<int> > recorded;
+  std::vector<int> quit;
+  bool window_should_close = false;
+  int frame = 0;
+  if (!headless) glfwSwapInterval(vsync ? 1 : 0);
+  TimerResolution timer_resolution;
+  frameScheduler.Start(headless ? INFINITY : framerate);
+  profiler.Start();
+  
+  while (!window_should_close) {
+    frame++;
+    profiler.StartFrame();
+    
+    DrawScene(width, height);
+    profiler.Mark(PHASE_DRAW);
+    Update();
+    profiler.Mark(PHASE_PRESENT);
+    
+    if (save_to_png) CaptureFrame(FrameFilename(filename, frame).c_str(), width, height, frame);
+    if (save_frames) CaptureFrame("", width, height, frame);
+    profiler.Mark(PHASE_CAPTURE);
+    
+    std::vector<int> input;
+    if (interactive) {
+      input = GetInputs();
+      recorded.push_back(input);
+    } else if (frame <= inputs.size()) {
+      input = Rcpp::as<std::vector<int> >(inputs[frame - 1]);
+    }
+    if (std::find(input.begin(), input.end(), GLFW_KEY_ESCAPE) != input.end()) window_should_close = true;
+    
+    // R behaviors see the scene as it was drawn, so they run before native ones.
+    int status = STEP_CONTINUE;
+    if (call_step) status = Rcpp::as<int>(step(frame, Rcpp::wrap(input)));
+    profiler.Mark(PHASE_STEP);
+    if (scene.ApplyBehaviors(frame, quit)) window_should_close = true;
+    profiler.Mark(PHASE_BEHAVIORS);
+    
+    if (status & STEP_QUIT) window_should_close = true;
+    if (status & STEP_RESTART) {
+      scene = initial_scene;
+      quit.clear();
+    }
+    if (WindowShouldClose()) window_should_close = true;
+    if (one_frame || (!interactive && frame >= inputs.size())) window_should_close = true;
+    
+    frameScheduler.Wait();
+    profiler.Mark(PHASE_WAIT);
+    Rcpp::checkUserInterrupt();
+  }
+  
+  // Captures are written while later frames are drawn, so their times are only known now.
+  profiler.Stop();
+  if (save_to_png || save_frames) frameCapture.Wait();
+  for (const std::pair<int, double>& written : frameCapture.TakeWriteTimes()) {
+    profiler.AddEncode(written.first, written.second);
+  }
+  
+  Rcpp::IntegerVector quit_elements(quit.begin(), quit.end());
+  for (int& i : quit_elements) i++;
+  return Rcpp::List::create(
+    Rcpp::Named("inputs") = interactive ? Rcpp::wrap(recorded) : Rcpp::wrap(inputs),
+    Rcpp::Named("quit") = quit_elements,
+    Rcpp::Named("stats") = GetStats(),
+    Rcpp::Named("frame_times") = frameScheduler.FrameTimes(),
+    Rcpp::Named("timings") = profiler.Table()
+  );
 }
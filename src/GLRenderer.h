@@ -3,19 +3,62 @@
 
 // #define GLFW_DLL
 #include "Mesh.h"
+#include "Terrain.h"
+#include "MeshCache.h"
+#include "OffscreenContext.h"
+#include "FrameCapture.h"
+#include "Scene.h"
+#include "UniformBlocks.h"
+#include "LightClusters.h"
+#include "Transparency.h"
+#include "FrameScheduler.h"
+#include "FrameProfiler.h"
 #include <GLFW/glfw3.h>
+#include <map>
 
 class GLRenderer {
 public:
 	// Call glfw and glad. Create window.
 	GLRenderer(const char* window_name, int width, int height);
+	
+	// If headless, render offscreen into a framebuffer object instead of a window.
+	GLRenderer(const char* window_name, int width, int height, bool headless);
 
 	// Initialise meshShaderProgram, taking path to vertex and fragment source file.
 	void InitMeshShaderProgram(const char* vertex_shader, const char* fragment_shader);
 	
-	void InitMesh(std::vector<float>& vertices, std::vector<GLuint>& indices);
+	// Initialise the program compositing objects blended order-independently, likewise.
+	void InitCompositeShaderProgram(const char* vertex_shader, const char* fragment_shader);
+	
+	// Initialise a mesh from the vertices of 10 values and 0-based indices of unpack_mesh(), 
+	// converted straight from the R vectors into mapped buffers without intermediate copies.
+	void InitMesh(Rcpp::NumericVector vertices, Rcpp::IntegerVector indices);
+	
+	// VertexLayout of meshes initialised from now on. VERTEX_COMPACT by default.
+	void SetVertexLayout(int layout);
+	
+	void UpdateMeshBuffer(int i, Rcpp::NumericVector vertices);
+	
+	// Initialise a mesh whose colors are kept apart from its positions and normals,
+	// coloring each vertex by a column of the matrix later passed to UpdateMeshColors().
+	void InitAnimatedMesh(Rcpp::NumericVector vertices, Rcpp::IntegerVector indices, std::vector<int>& color_columns);
 	
-	void UpdateMeshBuffer(int i, std::vector<float>& vertices);
+	// Upload only the colors of mesh i from a color matrix with 3 or 4 rows of values 0-255.
+	void UpdateMeshColors(int i, Rcpp::NumericMatrix color);
+	
+	// Initialise a mesh of the grid of st_as_obj() drawn as a quadtree of tiles, each at the coarsest level 
+	// of detail within tolerance pixels of the full-resolution surface. The grid is given as to GridMesh() 
+	// and color as to UpdateMeshColors(). If animated, colors are kept apart as by InitAnimatedMesh().
+	void InitTerrain(Rcpp::NumericMatrix relief, Rcpp::NumericVector geotransform, Rcpp::NumericMatrix corners, 
+                  bool globe, double radius, Rcpp::NumericMatrix color, double tolerance, bool animated);
+	
+	// Initialise a mesh from a file written by WriteMeshCache(), mapped into memory and uploaded from the 
+	// mapping with its animation and terrain tiles, so that nothing is unpacked or copied on the way.
+	void InitCachedMesh(std::string filename);
+	
+	// Keep every time step of the colors of animated mesh i on the GPU. 
+	// colors is a raw array of RGBA values with dimensions (4, n_cells, n_frames).
+	void SetMeshAnimation(int i, Rcpp::RawVector colors, int n_cells, int n_frames);
 
 	// Clear back buffer.
 	// Use at start of main loop before any render calls.
@@ -25,6 +68,48 @@ public:
   
 	// Render currently stored data in VAO/VBO/EBO.
 	void DrawMesh(int i, Rcpp::NumericVector p, Rcpp::NumericVector q);
+	
+	// Store the state of every scene element: kinds are ElementKind values, 
+	// positions, orientations and colors have one column per element, 
+	// meshes index the meshes drawn by objects, and blended marks objects drawn with 
+	// order-independent transparency.
+	void InitScene(Rcpp::IntegerVector kinds, Rcpp::NumericMatrix positions, Rcpp::NumericMatrix orientations, 
+                Rcpp::NumericMatrix colors, Rcpp::NumericVector fovs, Rcpp::NumericVector ranges, 
+                Rcpp::IntegerVector meshes, Rcpp::LogicalVector blended);
+	
+	// Run spin() on element i natively. direction is a SkewerDirection, or -1 to rotate about axis.
+	void AddSpin(int i, Rcpp::NumericVector axis, int direction, double angle, bool quit_after_cycle);
+	
+	// Show time step (frame - 1) %% n_frames of animated element i each frame natively.
+	void AddAnimation(int i, int n_frames, bool quit_after_cycle);
+	
+	// Show time step layer of animated element i, after its R behaviors have run.
+	void SetAnimationFrame(int i, int layer);
+	
+	// Replace the state of element i after its R behaviors have run.
+	void SetElement(int i, Rcpp::NumericVector position, Rcpp::NumericVector orientation, 
+                 Rcpp::NumericVector color, double fov, double range);
+	
+	// Current element positions and orientations, one column per element.
+	Rcpp::NumericMatrix GetPositions();
+	Rcpp::NumericMatrix GetOrientations();
+	
+	// Draw frames until the device is quit. step(frame, input) is called each frame 
+	// if call_step, returning a combination of StepStatus flags.
+	// filename, if not empty, is the PNG file of each frame and may contain an integer format.
+	// If save_frames, each frame is also passed to SaveFrame().
+	// Windows show framerate frames per second at most, or as many as can be drawn if infinite, 
+	// and if vsync wait for the display to refresh before each. Headless frames never wait.
+	// Returns the inputs of each frame, the 1-based elements that quit the device, GetStats(), 
+	// the seconds between successive frames and FrameProfiler::Table() of every frame.
+	Rcpp::List Run(Rcpp::Function step, bool call_step, Rcpp::List inputs, bool interactive, 
+                int width, int height, std::string filename, bool save_frames, bool one_frame, 
+                double framerate, bool vsync);
+
+	// Frames drawn by the last call to Run(), with the objects and terrain tiles drawn and 
+	// culled by the view frustum over all of them, and the frames dropped for missing 
+	// the target framerate. Unplaced objects are not counted.
+	Rcpp::NumericVector GetStats();
 
 	// Swap back and front buffers and poll for events.
 	void Update();
@@ -32,27 +117,106 @@ public:
 	// Returns the chars of keys pressed last frame.
 	std::vector<int> GetInputs();
 
-	// Stop the program for an interval to maintain a given number of frames per second.
-	void FramerateLimit(int framerate);
-
 	// Clear all buffers and destroy window.
 	void Delete();
 	
+	// Lights as 10 values each: position, direction, color in [0, 1] and range.
 	void SetLights(std::vector<float> lightdata);
 	void SetCamera(Rcpp::NumericVector p, Rcpp::NumericVector q, float FOVdeg, float aspect);
+	
+	// Queue the last frame drawn to be saved as a PNG file without waiting for it.
 	void SaveImage(const char* filepath, int width, int height);
 	
+	// Send frames saved by SaveFrame() to a GIF file until FinishImages() is called.
+	// delay is in seconds; loop is the number of repeats, 0 for forever or -1 for none.
+	void StartGif(const char* filepath, double delay, int loop);
+	
+	// Queue the last frame drawn to be added to the GIF started by StartGif().
+	void SaveFrame(int width, int height);
+	
+	// Block until every queued image has been written.
+	void FinishImages();
+	
 	bool WindowShouldClose();
 
-	GLFWwindow* window;	// Pointer to stored window.
+	GLFWwindow* window;	// Pointer to stored window. NULL if rendering without GLFW.
 	GLuint meshShaderProgram;
 	
 private:
 	// Gets the contents of a file at given path.
 	std::string GetFileContents(const char* filename);
-	double prevTime;
+	
+	// Compile and link a program from the vertex and fragment shader source files at given paths.
+	GLuint CompileShaderProgram(const char* vertex_shader, const char* fragment_shader);
+	
+	// Create a context without a visible window and a framebuffer object to render into.
+	void InitOffscreen(int width, int height);
+	
+	// Create or resize the framebuffer object scenes are drawn into and bind it. 
+	// Windows only draw into one to composite objects blended order-independently.
+	void InitFramebuffer(int width, int height);
+	
+	// Start reading the last frame drawn back to the frame capture ring.
+	// The time taken to write it is added to frame of Run(), if given.
+	void CaptureFrame(const char* filepath, int width, int height, int frame = -1);
+	
+	// Draw every object of the scene as seen from its first camera, 
+	// those blended order-independently last.
+	void DrawScene(int width, int height);
+	
+	// Whether object i is placed and oriented.
+	bool IsVisible(int i);
+	
+	// Whether the bounding sphere of placed object i is inside the view frustum in world coordinates.
+	bool IsInView(int i, const Frustum& world);
+	
+	// Create the uniform buffer backing the Camera and Lights blocks, and the instance buffer.
+	void InitBuffers();
+	
+	// Write camera or light state into uniformData, to be sent by UploadUniforms().
+	// Placed lights with a finite range are kept for AssignLights() instead.
+	void WriteCamera(const double* p, const double* q, float FOVdeg, float aspect);
+	void WriteLights(const std::vector<float>& lightdata);
+	
+	// Assign the local lights to the clusters of the last camera written and upload them.
+	void AssignLights();
+	
+	// Send bytes [from, to) of uniformData to the uniform buffer.
+	void UploadUniforms(size_t from, size_t to);
+	
+	// Send instanceData to the instance buffer.
+	void UploadInstances();
+	
+	// Count the draw calls and triangles of count instances drawn in ranges of indices.
+	void CountDraws(int count, const std::vector<GLsizei>& ranges);
+	
+	bool headless;
+	OffscreenContext offscreenContext;
+	GLuint framebuffer = 0, colorbuffer = 0, depthbuffer = 0;
+	int framebufferWidth = 0, framebufferHeight = 0;
+	FrameCapture frameCapture;
+	FrameScheduler frameScheduler;
+	FrameProfiler profiler;
 	int num_indices;
 	std::vector<Mesh> meshes;
+	std::map<int, Terrain> terrains;	// tiles of the meshes drawn as terrain, by mesh
+	int vertexLayout;
+	SceneState scene;
+	GLuint uniformBuffer, instanceBuffer;
+	GLint animationLayerLocation, orderIndependentLocation;
+	Transparency transparency;
+	Frustum frustum;	// of the last camera written, in camera coordinates
+	double cameraPosition[3] = {0, 0, 0}, cameraOrientation[4] = {1, 0, 0, 0};	// of the last camera written
+	LightClusters lightClusters;
+	std::vector<LocalLight> localLights;
+	double statsFrames = 0;
+	CullStats objectStats, tileStats;
+	size_t lightsOffset, instanceBufferSize;
+	std::vector<unsigned char> uniformData;	// CameraBlock, then LightsBlock at lightsOffset
+	std::vector<float> instanceData;				// INSTANCE_FLOATS per instance
 };
 
+// Returned by the step function passed to Run().
+enum StepStatus { STEP_CONTINUE = 0, STEP_QUIT = 1, STEP_RESTART = 2 };
+
 #endif
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "GifEncoder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+void PutShort(std::vector<unsigned char>& out, int value) {
+  out.push_back(value & 0xFF);
+  out.push_back((value >> 8) & 0xFF);
+}
+
+// Channel c (0 red, 1 green, 2 blue) of a 15-bit color.
+inline int Channel(int color, int c) {
+  return (color >> (10 - 5 * c)) & 0x1F;
+}
+
+struct Box {
+  int begin, end;  // range of the sorted color list
+  long pixels;
+};
+
+// Median cut over the colors present in hist. Fills palette (256 RGB entries)
+// with the mean 8-bit color of each box, from sums of the pixels in each 
+// 15-bit color, and sets lookup[color] to the palette index of every present color.
+void MedianCut(const std::vector<uint32_t>& hist, const std::vector<uint64_t>& sums,
+               unsigned char* palette, unsigned char* lookup) {
+  std::vector<int> colors;
+  for (int color = 0; color < 32768; color++) if (hist[color] > 0) colors.push_back(color);
+  
+  std::vector<Box> boxes;
+  long total = 0;
+  for (int color : colors) total += hist[color];
+  boxes.push_back(Box{0, (int) colors.size(), total});
+  
+  while (boxes.size() < 256) {
+    // Split the box with the widest channel range, weighted by its pixels.
+    int best = -1, best_channel = 0;
+    double best_score = 0;
+    for (size_t b = 0; b < boxes.size(); b++) {
+      if (boxes[b].end - boxes[b].begin < 2) continue;
+      for (int c = 0; c < 3; c++) {
+        int lo = 31, hi = 0;
+        for (int i = boxes[b].begin; i < boxes[b].end; i++) {
+          int value = Channel(colors[i], c);
+          lo = std::min(lo, value);
+          hi = std::max(hi, value);
+        }
+        double score = (double) (hi - lo) * boxes[b].pixels;
+        if (score > best_score) {
+          best_score = score;
+          best = b;
+          best_channel = c;
+        }
+      }
+    }
+    if (best < 0) break;
+    
+    Box box = boxes[best];
+    std::sort(colors.begin() + box.begin, colors.begin() + box.end, [&](int a, int b) {
+      return Channel(a, best_channel) < Channel(b, best_channel);
+    });
+    long half = 0;
+    int split = box.begin;
+    while (split < box.end - 1 && half + (long) hist[colors[split]] <= box.pixels / 2) {
+      half += hist[colors[split]];
+      split++;
+    }
+    if (split == box.begin) {
+      half += hist[colors[split]];
+      split++;
+    }
+    boxes[best] = Box{box.begin, split, half};
+    boxes.push_back(Box{split, box.end, box.pixels - half});
+  }
+  
+  std::memset(palette, 0, 3 * 256);
+  for (size_t b = 0; b < boxes.size(); b++) {
+    uint64_t sum[3] = {0, 0, 0};
+    for (int i = boxes[b].begin; i < boxes[b].end; i++) {
+      for (int c = 0; c < 3; c++) sum[c] += sums[3 * colors[i] + c];
+      lookup[colors[i]] = b;
+    }
+    for (int c = 0; c < 3; c++) {
+      if (boxes[b].pixels > 0) palette[3 * b + c] = (sum[c] + boxes[b].pixels / 2) / boxes[b].pixels;
+    }
+  }
+}
+
+// Variable-length codes packed least significant bit first into 255 byte sub-blocks.
+class CodeWriter {
+public:
+  CodeWriter(std::vector<unsigned char>& out) : out(out) {}
+  
+  void Write(int code, int size) {
+    bits |= (uint32_t) code << n_bits;
+    n_bits += size;
+    while (n_bits >= 8) {
+      Put(bits & 0xFF);
+      bits >>= 8;
+      n_bits -= 8;
+    }
+  }
+  
+  void Flush() {
+    if (n_bits > 0) Put(bits & 0xFF);
+    bits = 0;
+    n_bits = 0;
+    if (!block.empty()) EndBlock();
+    out.push_back(0);
+  }
+  
+private:
+  void Put(unsigned char byte) {
+    block.push_back(byte);
+    if (block.size() == 255) EndBlock();
+  }
+  
+  void EndBlock() {
+    out.push_back(block.size());
+    out.insert(out.end(), block.begin(), block.end());
+    block.clear();
+  }
+  
+  std::vector<unsigned char>& out;
+  std::vector<unsigned char> block;
+  uint32_t bits = 0;
+  int n_bits = 0;
+};
+
+// LZW compression of 8-bit indices with a hashed string table.
+void Lzw(const unsigned char* indices, size_t n, std::vector<unsigned char>& out) {
+  const int min_code_size = 8, clear_code = 256, end_code = 257;
+  const int table_size = 1 << 14;
+  std::vector<int32_t> keys(table_size);
+  std::vector<uint16_t> values(table_size);
+  
+  out.push_back(min_code_size);
+  CodeWriter writer(out);
+  
+  int code_size = min_code_size + 1, next_code = end_code + 1;
+  std::fill(keys.begin(), keys.end(), -1);
+  writer.Write(clear_code, code_size);
+  
+  if (n == 0) {
+    writer.Write(end_code, code_size);
+    writer.Flush();
+    return;
+  }
+  
+  int prefix = indices[0];
+  for (size_t i = 1; i < n; i++) {
+    int32_t key = (prefix << 8) | indices[i];
+    uint32_t slot = ((uint32_t) key * 2654435761u) >> 18;
+    while (keys[slot] != -1 && keys[slot] != key) slot = (slot + 1) & (table_size - 1);
+    if (keys[slot] == key) {
+      prefix = values[slot];
+      continue;
+    }
+    writer.Write(prefix, code_size);
+    keys[slot] = key;
+    values[slot] = next_code;
+    if (next_code == (1 << code_size) && code_size < 12) code_size++;
+    next_code++;
+    if (next_code == 4096) {
+      writer.Write(clear_code, code_size);
+      std::fill(keys.begin(), keys.end(), -1);
+      code_size = min_code_size + 1;
+      next_code = end_code + 1;
+    }
+    prefix = indices[i];
+  }
+  writer.Write(prefix, code_size);
+  // The decoder adds its last table entry on reading the final code.
+  if (next_code == (1 << code_size) && code_size < 12) code_size++;
+  writer.Write(end_code, code_size);
+  writer.Flush();
+}
+
+}
+
+std::vector<unsigned char> GifHeader(int width, int height, int loop) {
+  std::vector<unsigned char> out;
+  const char* signature = "GIF89a";
+  out.insert(out.end(), signature, signature + 6);
+  PutShort(out, width);
+  PutShort(out, height);
+  out.push_back(0);  // no global color table
+  out.push_back(0);  // background color
+  out.push_back(0);  // pixel aspect ratio
+  
+  if (loop >= 0) {
+    const char* application = "NETSCAPE2.0";
+    out.push_back(0x21);
+    out.push_back(0xFF);
+    out.push_back(11);
+    out.insert(out.end(), application, application + 11);
+    out.push_back(3);
+    out.push_back(1);
+    PutShort(out, loop);
+    out.push_back(0);
+  }
+  return out;
+}
+
+std::vector<unsigned char> GifFrame(const unsigned char* rgb, int width, int height, int delay) {
+  size_t n = (size_t) width * height;
+  std::vector<uint16_t> colors(n);
+  std::vector<uint32_t> hist(32768);
+  std::vector<uint64_t> sums(3 * 32768);
+  for (size_t i = 0; i < n; i++) {
+    const unsigned char* p = rgb + 3 * i;
+    uint16_t color = ((p[0] >> 3) << 10) | ((p[1] >> 3) << 5) | (p[2] >> 3);
+    colors[i] = color;
+    hist[color]++;
+    for (int c = 0; c < 3; c++) sums[3 * color + c] += p[c];
+  }
+  
+  unsigned char palette[3 * 256];
+  std::vector<unsigned char> lookup(32768);
+  MedianCut(hist, sums, palette, lookup.data());
+  
+  std::vector<unsigned char> indices(n);
+  for (size_t i = 0; i < n; i++) indices[i] = lookup[colors[i]];
+  
+  std::vector<unsigned char> out;
+  
+  // Graphics control extension
+  out.push_back(0x21);
+  out.push_back(0xF9);
+  out.push_back(4);
+  out.push_back(0);
+  PutShort(out, delay);
+  out.push_back(0);
+  out.push_back(0);
+  
+  // Image descriptor with a local color table of 256 entries
+  out.push_back(0x2C);
+  PutShort(out, 0);
+  PutShort(out, 0);
+  PutShort(out, width);
+  PutShort(out, height);
+  out.push_back(0x80 | 7);
+  out.insert(out.end(), palette, palette + 3 * 256);
+  
+  Lzw(indices.data(), n, out);
+  return out;
+}
@@ -0,0 +1,20 @@
+#ifndef GIF_ENCODER
+#define GIF_ENCODER
+
+#include <vector>
+
+// GIF89a encoding of RGB frames, each with its own 256 color palette.
+
+// Header and logical screen descriptor. loop is the number of repeats after 
+// the first play, 0 to repeat forever or negative to play once.
+std::vector<unsigned char> GifHeader(int width, int height, int loop);
+
+// One frame: palette by median cut over 15-bit colors, then LZW-compressed 
+// indices. rgb holds width * height pixels, top row first. delay is in 
+// hundredths of a second.
+std::vector<unsigned char> GifFrame(const unsigned char* rgb, int width, int height, int delay);
+
+// Marks the end of the file.
+const unsigned char GIF_TRAILER = 0x3B;
+
+#endif
@@ -0,0 +1,112 @@
+#include "GridMesh.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+RasterGrid MakeRasterGrid(const Rcpp::NumericMatrix& relief, const Rcpp::NumericVector& geotransform, 
+                          const Rcpp::NumericMatrix& corners, bool globe, double radius) {
+  RasterGrid grid = {relief.begin(), relief.nrow(), relief.ncol(), NULL, geotransform.begin(), globe, radius};
+  if (corners.ncol() > 0) {
+    if (corners.nrow() != 2 || corners.ncol() != (grid.nx + 1) * (grid.ny + 1))
+      Rcpp::stop("corners must have 2 rows and a column for each corner of the grid");
+    grid.corners = corners.begin();
+  } else if (geotransform.size() != 6) {
+    Rcpp::stop("geotransform must have length 6");
+  }
+  return grid;
+}
+
+void TriangleNormal(const double* p[3], double* out) {
+  for (int c = 0; c < 3; c++) out[c] = 0;
+  for (int k = 0; k < 3; k++) {
+    const double* a = p[k];
+    const double* b = p[(k + 1) % 3];
+    out[0] += (a[1] - b[1]) * (a[2] + b[2]);
+    out[1] += (a[2] - b[2]) * (a[0] + b[0]);
+    out[2] += (a[0] - b[0]) * (a[1] + b[1]);
+  }
+  double length = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+  for (int c = 0; c < 3; c++) out[c] /= length;
+}
+
+Rcpp::List GridMesh(Rcpp::NumericMatrix relief, Rcpp::NumericVector geotransform, Rcpp::NumericMatrix corners,
+                    bool globe, double radius) {
+  RasterGrid grid = MakeRasterGrid(relief, geotransform, corners, globe, radius);
+  int cx = grid.nx + 1, cy = grid.ny + 1;
+
+  ThreadPool pool;
+
+  // Count the used corners and valid cells of each row so every row knows where its output starts.
+  std::vector<int> corner_start(cy + 1), cell_start(cy + 1);
+  pool.ParallelFor(cy, [&](int from, int to) {
+    for (int j = from; j < to; j++) {
+      int n_corners = 0, n_cells = 0;
+      for (int i = 0; i < cx; i++) {
+        n_corners += !ISNAN(grid.CornerRelief(i, j));
+        n_cells += grid.Valid(i, j);
+      }
+      corner_start[j + 1] = n_corners;
+      cell_start[j + 1] = n_cells;
+    }
+  });
+  for (int j = 0; j < cy; j++) {
+    corner_start[j + 1] += corner_start[j];
+    cell_start[j + 1] += cell_start[j];
+  }
+  int n_vertices = corner_start[cy], n_cells = cell_start[cy];
+
+  Rcpp::NumericMatrix positions(3, n_vertices);
+  Rcpp::IntegerMatrix indices(3, 2 * n_cells);
+  Rcpp::NumericMatrix normals(3, 2 * n_cells);
+  Rcpp::IntegerMatrix normal_indices(3, 2 * n_cells);
+  double* position = positions.begin();
+  int* index = indices.begin();
+  double* normal = normals.begin();
+  int* normal_index = normal_indices.begin();
+  std::vector<int> vertex(cx * cy, 0);  // 1-based vertex of each corner, 0 if unused
+
+  pool.ParallelFor(cy, [&](int from, int to) {
+    for (int j = from; j < to; j++) {
+      int v = corner_start[j];
+      for (int i = 0; i < cx; i++) {
+        double height = grid.CornerRelief(i, j);
+        if (ISNAN(height)) continue;
+        grid.CornerPosition(i, j, height, position + 3 * v);
+        vertex[j * cx + i] = ++v;
+      }
+    }
+  });
+
+  // Corners of cell (i, j) in the order of its polygon, (i + 1, j), (i + 1, j + 1), (i, j + 1), (i, j),
+  // split into the triangles 1-2-3 and 3-4-1 as triangulate() would.
+  pool.ParallelFor(grid.ny, [&](int from, int to) {
+    for (int j = from; j < to; j++) {
+      int cell = cell_start[j];
+      for (int i = 0; i < grid.nx; i++) {
+        if (!grid.Valid(i, j)) continue;
+        int quad[4] = {vertex[j * cx + i + 1], vertex[(j + 1) * cx + i + 1], vertex[(j + 1) * cx + i], vertex[j * cx + i]};
+        const int split[2][3] = {{0, 1, 2}, {2, 3, 0}};
+        for (int t = 0; t < 2; t++) {
+          int triangle = cell + t * n_cells;
+          const double* p[3];
+          for (int k = 0; k < 3; k++) {
+            int v = quad[split[t][k]];
+            index[3 * triangle + k] = v;
+            normal_index[3 * triangle + k] = triangle + 1;
+            p[k] = position + 3 * (v - 1);
+          }
+          TriangleNormal(p, normal + 3 * triangle);
+        }
+        cell++;
+      }
+    }
+  });
+
+  return Rcpp::List::create(
+    Rcpp::Named("positions") = positions,
+    Rcpp::Named("indices") = indices,
+    Rcpp::Named("normals") = normals,
+    Rcpp::Named("normal_indices") = normal_indices
+  );
+}
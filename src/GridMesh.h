@@ -0,0 +1,68 @@
+#ifndef GRID_MESH
+#define GRID_MESH
+
+#include "Rcpp.h"
+#include <cmath>
+
+// Raster grid of nx by ny cells, x varying fastest, as passed to GridMesh().
+struct RasterGrid {
+  const double* relief;       // height of each cell, NA where the cell is left out
+  int nx, ny;
+  const double* corners;      // 2 coordinates per corner of the (nx + 1) by (ny + 1) corner grid, or NULL
+  const double* geotransform; // used if corners is NULL
+  bool globe;
+  double radius;
+
+  bool Valid(int i, int j) const {
+    return i >= 0 && j >= 0 && i < nx && j < ny && !ISNAN(relief[j * nx + i]);
+  }
+
+  // Relief of the first cell in grid order using corner (i, j), or NAN if it is unused.
+  double CornerRelief(int i, int j) const {
+    const int di[4] = {-1, 0, -1, 0}, dj[4] = {-1, -1, 0, 0};
+    for (int k = 0; k < 4; k++) {
+      if (Valid(i + di[k], j + dj[k])) return relief[(j + dj[k]) * nx + i + di[k]];
+    }
+    return NAN;
+  }
+
+  // Position of corner (i, j) raised by height.
+  void CornerPosition(int i, int j, double height, double* out) const {
+    int c = j * (nx + 1) + i;
+    const double* gt = geotransform;
+    double x = corners ? corners[2 * c] : gt[0] + i * gt[1] + j * gt[2];
+    double y = corners ? corners[2 * c + 1] : gt[3] + i * gt[4] + j * gt[5];
+    if (globe) {
+      const double deg_to_rad = 3.14159265358979323846 / 180;
+      double lon = x * deg_to_rad, lat = y * deg_to_rad, r = radius + height;
+      out[0] = -r * std::cos(lat) * std::cos(lon);
+      out[1] = r * std::sin(lat);
+      out[2] = r * std::cos(lat) * std::sin(lon);
+    } else {
+      out[0] = x;
+      out[1] = height;
+      out[2] = y;
+    }
+  }
+};
+
+// Check the arguments of GridMesh() and describe the grid they give.
+RasterGrid MakeRasterGrid(const Rcpp::NumericMatrix& relief, const Rcpp::NumericVector& geotransform,
+                          const Rcpp::NumericMatrix& corners, bool globe, double radius);
+
+// Newell's method, as in add_normals(): unit normal of the triangle p[0], p[1], p[2].
+void TriangleNormal(const double* p[3], double* out);
+
+// Triangulated surface of a raster grid of nx by ny cells, x varying fastest, in one pass over the grid.
+// relief gives the height of each cell, NA where the cell is left out. Corners are shared by every cell
+// using them and take the relief of the first such cell. Corner coordinates are given by the columns of
+// corners, one per corner of the (nx + 1) by (ny + 1) corner grid, or if corners has no columns, by the
+// GDAL-style geotransform: x = gt[0] + i * gt[1] + j * gt[2], y = gt[3] + i * gt[4] + j * gt[5].
+// If globe, coordinates are longitude and latitude in degrees, placed on a sphere of the given radius
+// raised by the relief, otherwise (x, relief, y). Each cell is split into two triangles, the first of
+// every cell followed by the second of every cell, each with its own flat normal.
+// Returns the positions, 1-based indices, normals and normal_indices of a scenesetr_obj.
+Rcpp::List GridMesh(Rcpp::NumericMatrix relief, Rcpp::NumericVector geotransform, Rcpp::NumericMatrix corners,
+                    bool globe, double radius);
+
+#endif
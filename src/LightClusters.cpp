@@ -0,0 +1,159 @@
+#include "LightClusters.h"
+#include "Quaternion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+LightClusters::LightClusters() : max_texels(0), count(0), stale(true), fovy(0), aspect(0), near(0), far(0), slice_scale(0),
+                                 tan_x(0), tan_y(0) {
+  std::fill(buffers, buffers + 3, 0);
+  std::fill(textures, textures + 3, 0);
+  std::fill(pose, pose + 7, 0);
+}
+
+void LightClusters::Init(GLuint program) {
+  const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+  const char* samplers[3] = {"localLights", "lightClusters", "lightIndices"};
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+  stale = true;
+  glGenBuffers(3, buffers);
+  glGenTextures(3, textures);
+  glUseProgram(program);
+  for (int t = 0; t < 3; t++) {
+    Upload(LOCAL_LIGHTS_UNIT + t, buffers[t], 0, NULL);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[t], buffers[t]);
+    glUniform1i(glGetUniformLocation(program, samplers[t]), LOCAL_LIGHTS_UNIT + t);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::SetProjection(double fovy, double aspect, double near, double far) {
+  if (fovy == this->fovy && aspect == this->aspect && near == this->near && far == this->far) return;
+  stale = true;
+  this->fovy = fovy;
+  this->aspect = aspect;
+  this->near = near;
+  this->far = far;
+  tan_y = std::tan(fovy * QUATERNION_PI / 360);
+  tan_x = tan_y * aspect;
+  slice_scale = CLUSTERS_Z / std::log(far / near);
+  depths.resize(CLUSTERS_Z + 1);
+  for (int k = 0; k <= CLUSTERS_Z; k++) depths[k] = near * std::pow(far / near, (double) k / CLUSTERS_Z);
+
+  // Each cluster is bounded by its tile's planes through the origin, so it is widest at its far end.
+  boxes.resize(6 * CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z);
+  double* box = boxes.data();
+  for (int k = 0; k < CLUSTERS_Z; k++) {
+    for (int j = 0; j < CLUSTERS_Y; j++) {
+      for (int i = 0; i < CLUSTERS_X; i++, box += 6) {
+        const double x[2] = {-1 + 2.0 * i / CLUSTERS_X, -1 + 2.0 * (i + 1) / CLUSTERS_X};
+        const double y[2] = {-1 + 2.0 * j / CLUSTERS_Y, -1 + 2.0 * (j + 1) / CLUSTERS_Y};
+        const double d[2] = {depths[k], depths[k + 1]};
+        box[0] = std::min(x[0] * d[0], x[0] * d[1]) * tan_x;
+        box[1] = std::max(x[1] * d[0], x[1] * d[1]) * tan_x;
+        box[2] = std::min(y[0] * d[0], y[0] * d[1]) * tan_y;
+        box[3] = std::max(y[1] * d[0], y[1] * d[1]) * tan_y;
+        box[4] = d[0];
+        box[5] = d[1];
+      }
+    }
+  }
+}
+
+size_t LightClusters::Assign(const std::vector<LocalLight>& lights, const double* p, const double* q) {
+  // Without lights every cluster is empty wherever the camera is.
+  bool moved = !lights.empty() && (!std::equal(p, p + 3, pose) || !std::equal(q, q + 4, pose + 3));
+  bool same_lights = lights.size() == assigned.size() &&
+    (lights.empty() || std::memcmp(lights.data(), assigned.data(), lights.size() * sizeof(LocalLight)) == 0);
+  if (!stale && !moved && same_lights) return 0;
+  stale = false;
+  assigned = lights;
+  std::copy(p, p + 3, pose);
+  std::copy(q, q + 4, pose + 3);
+
+  const int n_clusters = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+  const double inverse[4] = {q[0], -q[1], -q[2], -q[3]};
+  size_t n_lights = std::min(lights.size(), (size_t) max_texels / 3);
+
+  // Pairs of cluster and light, in the order of the lights.
+  std::vector<GLuint> hits;
+  for (size_t l = 0; l < n_lights && !depths.empty(); l++) {
+    const LocalLight& light = lights[l];
+    double offset[3], view[3];
+    for (int c = 0; c < 3; c++) offset[c] = light.position[c] - p[c];
+    QRotate(inverse, offset, view);
+    const double center[3] = {view[0], view[1], -view[2]};
+    const double r = light.range;
+    if (center[2] + r < near || center[2] - r > far) continue;
+
+    for (int k = Slice(center[2] - r); k <= Slice(center[2] + r); k++) {
+      // Tiles covered by the sphere's bounding box over the depths it shares with this slice.
+      double d[2] = {std::max(depths[k], center[2] - r), std::min(depths[k + 1], center[2] + r)};
+      double low[2], high[2];
+      for (int a = 0; a < 2; a++) {
+        double lo = center[a] - r, hi = center[a] + r, scale = a == 0 ? tan_x : tan_y;
+        low[a] = (lo >= 0 ? lo / d[1] : lo / d[0]) / scale;
+        high[a] = (hi >= 0 ? hi / d[0] : hi / d[1]) / scale;
+      }
+      if (high[0] < -1 || low[0] > 1 || high[1] < -1 || low[1] > 1) continue;
+      for (int j = Tile(low[1], CLUSTERS_Y); j <= Tile(high[1], CLUSTERS_Y); j++) {
+        for (int i = Tile(low[0], CLUSTERS_X); i <= Tile(high[0], CLUSTERS_X); i++) {
+          int cluster = (k * CLUSTERS_Y + j) * CLUSTERS_X + i;
+          const double* box = &boxes[6 * cluster];
+          double distance = 0;
+          for (int a = 0; a < 3; a++) {
+            double outside = center[a] - std::min(std::max(center[a], box[2 * a]), box[2 * a + 1]);
+            distance += outside * outside;
+          }
+          if (distance > r * r) continue;
+          hits.push_back(cluster);
+          hits.push_back(l);
+        }
+      }
+    }
+  }
+  size_t n_hits = std::min(hits.size() / 2, (size_t) max_texels);
+
+  // Sort the light indices by cluster, keeping the first index and count of each.
+  std::vector<GLuint> clusters(2 * n_clusters, 0), indices(n_hits);
+  for (size_t h = 0; h < n_hits; h++) clusters[2 * hits[2 * h] + 1]++;
+  for (int c = 1; c < n_clusters; c++) clusters[2 * c] = clusters[2 * c - 2] + clusters[2 * c - 1];
+  std::vector<GLuint> filled(n_clusters, 0);
+  for (size_t h = 0; h < n_hits; h++) {
+    GLuint c = hits[2 * h];
+    indices[clusters[2 * c] + filled[c]++] = hits[2 * h + 1];
+  }
+
+  count = n_lights;
+  const size_t sizes[3] = {n_lights * sizeof(LocalLight), clusters.size() * sizeof(GLuint), 
+                           indices.size() * sizeof(GLuint)};
+  Upload(LOCAL_LIGHTS_UNIT, buffers[0], sizes[0], lights.data());
+  Upload(LIGHT_CLUSTERS_UNIT, buffers[1], sizes[1], clusters.data());
+  Upload(LIGHT_INDICES_UNIT, buffers[2], sizes[2], indices.data());
+  glActiveTexture(GL_TEXTURE0);
+  return sizes[0] + sizes[1] + sizes[2];
+}
+
+int LightClusters::Slice(double d) const {
+  if (d <= near) return 0;
+  return std::min((int) (std::log(d / near) * slice_scale), CLUSTERS_Z - 1);
+}
+
+int LightClusters::Tile(double x, int n) {
+  return std::min(std::max((int) std::floor((x + 1) / 2 * n), 0), n - 1);
+}
+
+void LightClusters::Upload(int unit, GLuint buffer, size_t size, const void* data) {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_BUFFER, textures[unit - LOCAL_LIGHTS_UNIT]);
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  // Never empty, as a texture buffer of no storage may not be complete.
+  glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t) 16), NULL, GL_STREAM_DRAW);
+  if (size > 0) glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+}
+
+void LightClusters::Delete() {
+  glDeleteTextures(3, textures);
+  glDeleteBuffers(3, buffers);
+}
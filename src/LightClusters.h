@@ -0,0 +1,73 @@
+#ifndef LIGHT_CLUSTERS
+#define LIGHT_CLUSTERS
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <vector>
+
+// Clusters of the view frustum: tiles across and up the screen, and slices in depth.
+const int CLUSTERS_X = 16, CLUSTERS_Y = 9, CLUSTERS_Z = 24;
+
+// Texture units of the samplers of mesh.frag. Unit 0 holds the colors of animated meshes.
+enum LightTextureUnit { LOCAL_LIGHTS_UNIT = 1, LIGHT_CLUSTERS_UNIT = 2, LIGHT_INDICES_UNIT = 3 };
+
+// Placed light with a finite range, as three RGBA texels of the localLights sampler.
+struct LocalLight {
+  float position[3], range;
+  float direction[3], spot;  // spot is 1 for a spotlight and 0 for a point light
+  float color[3], padding;
+};
+
+// Lists of the local lights that can reach each cluster of the view frustum, so that a fragment shades only
+// the lights listed for its cluster however many there are in the scene. The frustum is split into
+// CLUSTERS_X by CLUSTERS_Y tiles of the screen and CLUSTERS_Z slices of depth, spaced exponentially from
+// the near to the far plane so that clusters are about as deep as they are wide. The lists are rebuilt on
+// the CPU only when the camera or lights change, and read by mesh.frag from three texture buffers: the
+// lights, the first index and count of each cluster, and the light indices of every cluster in turn.
+class LightClusters {
+public:
+  LightClusters();
+
+  // Create the texture buffers and point the samplers of program at them.
+  void Init(GLuint program);
+
+  // Split the frustum of a perspective projection with vertical field of view fovy in degrees.
+  void SetProjection(double fovy, double aspect, double near, double far);
+
+  // Assign lights, in world coordinates, to the clusters of a camera at position p with orientation
+  // q (w, x, y, z) looking down its negative z axis, and upload them. Lights that cannot reach the
+  // frustum are left out, as are any beyond what the GPU's texture buffers can hold. Nothing is done
+  // if neither the lights, the camera nor the projection have changed since the last call.
+  // Returns the bytes uploaded.
+  size_t Assign(const std::vector<LocalLight>& lights, const double* p, const double* q);
+
+  // Lights uploaded by the last Assign().
+  int Count() const { return count; }
+
+  // Depth of the near plane, and depth slices per unit of log depth, for the Lights block.
+  double Near() const { return near; }
+  double SliceScale() const { return slice_scale; }
+
+  void Delete();
+
+private:
+  // Slice of positive depth d, clamped to the frustum.
+  int Slice(double d) const;
+
+  // Tile of normalised device coordinate x across n tiles, clamped to the screen.
+  static int Tile(double x, int n);
+
+  void Upload(int unit, GLuint buffer, size_t size, const void* data);
+
+  GLuint buffers[3], textures[3];
+  GLint max_texels;
+  int count;
+  bool stale;                        // projection changed, or nothing assigned yet
+  std::vector<LocalLight> assigned;  // lights of the last Assign()
+  double pose[7];                    // camera position and orientation of the last Assign()
+  double fovy, aspect, near, far, slice_scale, tan_x, tan_y;
+  std::vector<double> depths;  // CLUSTERS_Z + 1 slice boundaries
+  std::vector<double> boxes;   // x, y and depth bounds (low, high) of each cluster in camera coordinates
+};
+
+#endif
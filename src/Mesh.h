@@ -3,15 +3,273 @@
 
 #include <glad/glad.h>
 #include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
 #include "Rcpp.h"
+#include "StreamBuffer.h"
+
+// Layout of a vertex in the array buffer. Vertices are always given as 10 floats: 
+// position (x, y, z), normal (x, y, z) and color (r, g, b, a) in [0, 1].
+// VERTEX_FLOAT stores them as they are in 40 bytes. VERTEX_COMPACT stores the position as floats,
+// the normal as GL_INT_2_10_10_10_REV and the color as GL_UNSIGNED_BYTE in 20 bytes.
+// Meshes whose colors change keep them in a separate buffer of GL_UNSIGNED_BYTE RGBA instead.
+enum VertexLayout { VERTEX_FLOAT, VERTEX_COMPACT };
+
+// Floats per instance in the instance buffer: objPos (x, y, z) then objQuat (x, y, z, w).
+const int INSTANCE_FLOATS = 7;
 
 class Mesh {
 public:
   
-  Mesh(std::vector<float>& vertices, std::vector<GLuint>& indices) {
+  // color_columns, if not empty, gives the column of the color matrix passed to UpdateColors() 
+  // that colors each vertex, and puts colors in their own buffer.
+  Mesh(std::vector<float>& vertices, std::vector<GLuint>& indices, int layout = VERTEX_COMPACT, 
+       const std::vector<int>& color_columns = std::vector<int>()) 
+    : Mesh(vertices.data(), vertices.size() / 10, indices.data(), indices.size(), layout, color_columns) {}
+  
+  // Mesh of n_vertices vertices of 10 values and num_indices 0-based indices of any numeric type, 
+  // such as the contents of R vectors, each converted once straight into its mapped buffer.
+  template <typename T, typename I>
+  Mesh(const T* vertices, size_t n_vertices, const I* indices, size_t num_indices, int layout = VERTEX_COMPACT, 
+       const std::vector<int>& color_columns = std::vector<int>()) 
+    : colorVBO(0), cellVBO(0), animationTexture(0), layout(layout), colorColumns(color_columns) {
     
-    num_indices = indices.size();
-    array_size = vertices.size() * sizeof(float);
+    split_colors = !color_columns.empty();
+    Bound(vertices, n_vertices, center, radius);
+    // 16-bit indices whenever every vertex can be reached with them.
+    Upload(NULL, n_vertices, NULL, num_indices, n_vertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, NULL);
+    
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    WriteBuffer(GL_ARRAY_BUFFER, array_size, [&](unsigned char* out) { 
+      Pack(vertices, n_vertices, this->layout, split_colors, out); 
+    });
+    WriteBuffer(GL_ELEMENT_ARRAY_BUFFER, num_indices * IndexSize(), [&](unsigned char* out) {
+      if (index_type == GL_UNSIGNED_SHORT) std::copy(indices, indices + num_indices, (GLushort*) out);
+      else std::copy(indices, indices + num_indices, (GLuint*) out);
+    });
+    if (split_colors) {
+      glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
+      WriteBuffer(GL_ARRAY_BUFFER, 4 * n_vertices, [&](unsigned char* out) { PackColors(vertices, n_vertices, out); });
+    }
+    glBindVertexArray(0);
+  }
+  
+  // Mesh of vertices already packed in layout, as by Pack() and PackColors(), with indices of index_type
+  // and the given bounding sphere, uploaded straight from memory such as a mapped MeshCache file.
+  Mesh(const unsigned char* data, size_t n_vertices, const void* indices, GLsizei num_indices, GLenum index_type, 
+       int layout, const unsigned char* colors, const std::vector<int>& color_columns, const double* center, double radius)
+    : colorVBO(0), cellVBO(0), animationTexture(0), layout(layout), colorColumns(color_columns), radius(radius) {
+    split_colors = !color_columns.empty();
+    std::copy(center, center + 3, this->center);
+    Upload(data, n_vertices, indices, num_indices, index_type, colors);
+  }
+  
+  // Draw count instances whose transforms start at instance first of instanceBuffer.
+  void Draw(GLuint instanceBuffer, int first, int count) {
+    DrawRanges(instanceBuffer, first, count, std::vector<GLsizei>{0, num_indices});
+  }
+  
+  // Draw count instances of only the given ranges of the index buffer, as pairs of first index and count.
+  void DrawRanges(GLuint instanceBuffer, int first, int count, const std::vector<GLsizei>& ranges) {
+    const GLsizei stride = INSTANCE_FLOATS * sizeof(float);
+    const size_t index_size = IndexSize();
+    
+    glBindVertexArray(VAO);
+    if (animationTexture != 0) {
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, animationTexture);
+    }
+    // There is no base instance in OpenGL 3.3, so the instance attributes are offset instead.
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)((size_t) first * stride));
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, stride, (void*)((size_t) first * stride + 3 * sizeof(float)));
+    for (size_t r = 0; r + 1 < ranges.size(); r += 2) {
+      glDrawElementsInstanced(GL_TRIANGLES, ranges[r + 1], index_type, (void*)(ranges[r] * index_size), count);
+    }
+    glBindVertexArray(0);
+  }
+  
+  // Replace the n_vertices vertices of 10 values of the mesh, converted straight into the next segment
+  // of its vertex stream, which the mesh draws from instead of its first array buffer from then on.
+  // Returns the bytes uploaded.
+  template <typename T>
+  size_t UpdateArrayBuffer(const T* vertices, size_t n_vertices) {
+    Bound(vertices, n_vertices, center, radius);
+    size_t size = n_vertices * Stride(layout, split_colors);
+    size_t offset = vertexStream.Write(size, [&](unsigned char* out) {
+      Pack(vertices, n_vertices, layout, split_colors, out);
+    });
+    glBindVertexArray(VAO);
+    PointVertices(offset);
+    glBindVertexArray(0);
+    return size;
+  }
+  
+  // Replace only the colors of a mesh created with color_columns, 
+  // given a color matrix (0-255, 3 or 4 rows) in column-major order. Returns the bytes uploaded.
+  size_t UpdateColors(const double* color, int nrow, int ncol) {
+    size_t offset = colorStream.Write(4 * colorColumns.size(), [&](unsigned char* colors) {
+      for (size_t i = 0; i < colorColumns.size(); i++) {
+        int j = colorColumns[i];
+        for (int k = 0; k < 4; k++) {
+          colors[4 * i + k] = j >= ncol ? 0 : k < nrow ? Quantize(color[j * nrow + k] / 255, 0, 255) : 255;
+        }
+      }
+    });
+    glBindVertexArray(VAO);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4, (void*) offset);
+    glBindVertexArray(0);
+    return 4 * colorColumns.size();
+  }
+  
+  // Keep every time step of an animation on the GPU, in a texture array with one layer per step.
+  // colors holds RGBA values 0-255 for n_cells cells in each of n_frames steps. A mesh created 
+  // with color_columns colors each vertex by cell color_columns % n_cells of the layer chosen
+  // by the animationLayer uniform.
+  void InitAnimation(const unsigned char* colors, int n_cells, int n_frames) {
+    GLint max_size, max_layers;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    if (n_frames > max_layers) Rcpp::stop("animations are limited to %i time steps on this GPU", max_layers);
+    if (n_cells < 1 || n_frames < 1) return;
+    
+    // Cells wrap onto rows as the texture may be narrower than the raster.
+    int width = std::min(n_cells, (int) max_size);
+    int full_rows = n_cells / width, rest = n_cells % width;
+    glGenTextures(1, &animationTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, animationTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, full_rows + (rest > 0), n_frames, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int layer = 0; layer < n_frames; layer++) {
+      const unsigned char* step = colors + (size_t) layer * n_cells * 4;
+      if (full_rows > 0) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, full_rows, 1, GL_RGBA, GL_UNSIGNED_BYTE, step);
+      }
+      if (rest > 0) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, full_rows, layer, rest, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, 
+                        step + (size_t) full_rows * width * 4);
+      }
+    }
+    
+    std::vector<GLint> cells(colorColumns.size());
+    for (size_t i = 0; i < cells.size(); i++) cells[i] = colorColumns[i] % n_cells;
+    glBindVertexArray(VAO);
+    glGenBuffers(1, &cellVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, cellVBO);
+    glBufferData(GL_ARRAY_BUFFER, cells.size() * sizeof(GLint), cells.data(), GL_STATIC_DRAW);
+    glVertexAttribIPointer(5, 1, GL_INT, 0, (void*)0);
+    glEnableVertexAttribArray(5);
+    glBindVertexArray(0);
+  }
+  
+  // Sphere around every vertex, in the mesh's own coordinates.
+  const double* Center() const {
+    return center;
+  }
+  
+  double Radius() const {
+    return radius;
+  }
+  
+  // Indices drawn for each instance by Draw().
+  GLsizei IndexCount() const {
+    return num_indices;
+  }
+  
+  bool IsAnimated() {
+    return animationTexture != 0;
+  }
+  
+  void Delete() {
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    if (colorVBO != 0) glDeleteBuffers(1, &colorVBO);
+    if (cellVBO != 0) glDeleteBuffers(1, &cellVBO);
+    if (animationTexture != 0) glDeleteTextures(1, &animationTexture);
+    vertexStream.Delete();
+    colorStream.Delete();
+  }
+  
+  // Bounding sphere of n_vertices vertices of 10 values, centered on the middle of their bounding box.
+  template <typename T>
+  static void Bound(const T* vertices, size_t n_vertices, double* center, double& radius) {
+    double low[3] = {INFINITY, INFINITY, INFINITY}, high[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t i = 0; i < n_vertices; i++) {
+      for (int c = 0; c < 3; c++) {
+        low[c] = std::min(low[c], (double) (float) vertices[10 * i + c]);
+        high[c] = std::max(high[c], (double) (float) vertices[10 * i + c]);
+      }
+    }
+    radius = 0;
+    for (int c = 0; c < 3; c++) center[c] = n_vertices == 0 ? 0 : (low[c] + high[c]) / 2;
+    for (size_t i = 0; i < n_vertices; i++) {
+      const T* p = vertices + 10 * i;
+      double d[3] = {(float) p[0] - center[0], (float) p[1] - center[1], (float) p[2] - center[2]};
+      radius = std::max(radius, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+    }
+  }
+  
+  static void Bound(const std::vector<float>& vertices, double* center, double& radius) {
+    Bound(vertices.data(), vertices.size() / 10, center, radius);
+  }
+  
+  // Bytes per vertex in VBO.
+  static GLsizei Stride(int layout, bool split_colors) {
+    if (layout == VERTEX_COMPACT) return split_colors ? 16 : 20;
+    return (split_colors ? 6 : 10) * sizeof(float);
+  }
+  
+  // Convert n_vertices vertices of 10 values to the bytes of layout at out, 
+  // leaving out colors if split_colors.
+  template <typename T>
+  static void Pack(const T* vertices, size_t n_vertices, int layout, bool split_colors, unsigned char* out) {
+    GLsizei stride = Stride(layout, split_colors);
+    for (size_t i = 0; i < n_vertices; i++, out += stride) {
+      float vertex[10];
+      for (int j = 0; j < 10; j++) vertex[j] = vertices[10 * i + j];
+      if (layout != VERTEX_COMPACT) {
+        std::memcpy(out, vertex, stride);
+        continue;
+      }
+      std::memcpy(out, vertex, 3 * sizeof(float));
+      GLuint normal = 0;
+      for (int j = 0; j < 3; j++) normal |= (GLuint) (Quantize(vertex[3 + j], -511, 511) & 0x3FF) << (10 * j);
+      std::memcpy(out + 12, &normal, sizeof(normal));
+      if (!split_colors) for (int j = 0; j < 4; j++) out[16 + j] = Quantize(vertex[6 + j], 0, 255);
+    }
+  }
+  
+  static std::vector<unsigned char> Pack(const std::vector<float>& vertices, int layout, bool split_colors) {
+    std::vector<unsigned char> data(vertices.size() / 10 * Stride(layout, split_colors));
+    Pack(vertices.data(), vertices.size() / 10, layout, split_colors, data.data());
+    return data;
+  }
+  
+  // RGBA bytes of each vertex at out, for the color buffer of a mesh with split colors.
+  template <typename T>
+  static void PackColors(const T* vertices, size_t n_vertices, unsigned char* out) {
+    for (size_t i = 0; i < 4 * n_vertices; i++) out[i] = Quantize(vertices[i / 4 * 10 + 6 + i % 4], 0, 255);
+  }
+  
+  static std::vector<unsigned char> PackColors(const std::vector<float>& vertices) {
+    std::vector<unsigned char> colors(vertices.size() / 10 * 4);
+    PackColors(vertices.data(), vertices.size() / 10, colors.data());
+    return colors;
+  }
+  
+private:
+  void Upload(const unsigned char* data, size_t n_vertices, const void* indices, GLsizei num_indices, 
+              GLenum index_type, const unsigned char* colors) {
+    this->num_indices = num_indices;
+    this->index_type = index_type;
+    GLsizei stride = Stride(layout, split_colors);
+    array_size = n_vertices * stride;
     
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -20,48 +278,76 @@ public:
     glBindVertexArray(VAO);
     
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, array_size, vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, array_size, data, GL_STATIC_DRAW);
     
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * IndexSize(), indices, GL_STATIC_DRAW);
     
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)0);
+    PointVertices(0);
+    if (split_colors) {
+      glGenBuffers(1, &colorVBO);
+      glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
+      glBufferData(GL_ARRAY_BUFFER, n_vertices * 4, colors, GL_STATIC_DRAW);
+      glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4, (void*)0);
+    }
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(6 * sizeof(float)));
     glEnableVertexAttribArray(2);
     
+    // Per-instance transforms, pointed at the instance buffer by Draw().
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+    
     glBindVertexArray(0);
   }
   
-  void Draw(GLuint shaderProgram, Rcpp::NumericVector p, Rcpp::NumericVector q) {
-    glUniform3f(glGetUniformLocation(shaderProgram, "objPos"), p[0], p[1], p[2]);
-    glUniform4f(glGetUniformLocation(shaderProgram, "objQuat"), q[1], q[2], q[3], q[0]);
-    
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+  // Point the position, normal and, unless colors are split, color attributes of the bound vertex array
+  // at vertices starting offset bytes into the buffer bound to GL_ARRAY_BUFFER.
+  void PointVertices(size_t offset) {
+    GLsizei stride = Stride(layout, split_colors);
+    if (layout == VERTEX_COMPACT) {
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+      glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(offset + 12));
+      if (!split_colors) glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(offset + 16));
+    } else {
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(offset + 3 * sizeof(float)));
+      if (!split_colors) glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + 6 * sizeof(float)));
+    }
   }
   
-  void UpdateArrayBuffer(std::vector<float>& vertices) {
-    // orphan the buffer so that we can write new data without waiting for it to be unused
-    // as soon as it's finished being used it will automatically be freed so we don't care about it anymore
-    glBufferData(GL_ARRAY_BUFFER, array_size, NULL, GL_STREAM_DRAW);
-    
-    // fill the newly-allocated buffer with our new data
-    glBufferData(GL_ARRAY_BUFFER, array_size, vertices.data(), GL_STREAM_DRAW);
+  // Write size bytes into the buffer bound to target through write(pointer) on a mapping of it, 
+  // discarding what it held, so that the driver needs no copy of its own.
+  template <typename F>
+  static void WriteBuffer(GLenum target, size_t size, F write) {
+    if (size == 0) return;
+    void* out = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (out == NULL) Rcpp::stop("cannot map a buffer of %.0f bytes", (double) size);
+    write((unsigned char*) out);
+    glUnmapBuffer(target);
   }
   
-  void Delete() {
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
+  size_t IndexSize() const {
+    return index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
   }
   
-private:
-  GLuint VBO, VAO, EBO;
-  int num_indices, array_size;
+  // Scale x in [-1, 1] or [0, 1] to an integer in [min, max]. NaN becomes 0.
+  static int Quantize(float x, int min, int max) {
+    if (std::isnan(x)) return 0;
+    float scaled = std::round(x * max);
+    return (int) std::fmax(std::fmin(scaled, (float) max), (float) min);
+  }
+  
+  GLuint VBO, VAO, EBO, colorVBO, cellVBO, animationTexture;
+  GLenum index_type;
+  int layout, num_indices, array_size;
+  bool split_colors;
+  std::vector<int> colorColumns;
+  double center[3], radius;
+  // Buffers of per-frame vertex and color updates, created by the first of each.
+  StreamBuffer vertexStream, colorStream;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,234 @@
+#include "MeshCache.h"
+#include "Mesh.h"
+#include "MeshTools.h"
+#include "GridMesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char MAGIC[8] = {'s', 'c', 'n', 's', 'm', 'e', 's', 'h'};
+
+bool HasElement(Rcpp::List& object, const char* name) {
+  return object.containsElementNamed(name) && !Rf_isNull(object[name]);
+}
+
+uint64_t Align(uint64_t offset) {
+  return (offset + 7) / 8 * 8;
+}
+
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename) : data(NULL), size(0), file(NULL), mapping(NULL) {
+  HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open file: " + filename);
+  file = handle;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(handle);
+    throw std::runtime_error("cannot map empty file: " + filename);
+  }
+  size = (size_t) file_size.QuadPart;
+  mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping != NULL) data = (const unsigned char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data == NULL) {
+    if (mapping != NULL) CloseHandle(mapping);
+    CloseHandle(handle);
+    throw std::runtime_error("cannot map file: " + filename);
+  }
+}
+
+MappedFile::~MappedFile() {
+  UnmapViewOfFile(data);
+  CloseHandle(mapping);
+  CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename) : data(NULL), size(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("cannot open file: " + filename);
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("cannot map empty file: " + filename);
+  }
+  size = info.st_size;
+  void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds its own reference to the file.
+  close(fd);
+  if (mapped == MAP_FAILED) throw std::runtime_error("cannot map file: " + filename);
+  data = (const unsigned char*) mapped;
+}
+
+MappedFile::~MappedFile() {
+  munmap((void*) data, size);
+}
+
+#endif
+
+const MeshCacheHeader& CheckMeshCache(const MappedFile& file, const std::string& filename) {
+  if (file.Size() < sizeof(MeshCacheHeader) || std::memcmp(file.Data(), MAGIC, sizeof(MAGIC)) != 0) {
+    throw std::runtime_error("not a scenesetr mesh cache: " + filename);
+  }
+  const MeshCacheHeader& header = *(const MeshCacheHeader*) file.Data();
+  if (header.version != MESH_CACHE_VERSION || header.byte_order != 1) {
+    throw std::runtime_error("mesh cache written by another version of scenesetr or another machine: " + filename);
+  }
+  for (int s = 0; s < N_CACHE_SECTIONS; s++) {
+    if (header.offsets[s] % 8 != 0 || header.offsets[s] > file.Size() || header.sizes[s] > file.Size() - header.offsets[s]) {
+      throw std::runtime_error("truncated mesh cache: " + filename);
+    }
+  }
+  uint64_t split = header.split_colors ? header.n_vertices : 0;
+  bool consistent = (header.layout == VERTEX_FLOAT || header.layout == VERTEX_COMPACT) &&
+    (header.index_type == GL_UNSIGNED_SHORT || header.index_type == GL_UNSIGNED_INT) &&
+    header.sizes[CACHE_VERTICES] == header.n_vertices * Mesh::Stride(header.layout, header.split_colors) &&
+    header.sizes[CACHE_INDICES] == header.n_indices * (header.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint)) &&
+    header.sizes[CACHE_COLORS] == 4 * split && header.sizes[CACHE_COLOR_COLUMNS] == sizeof(int32_t) * split &&
+    header.sizes[CACHE_ANIMATION] == 4 * header.n_cells * header.n_frames &&
+    header.sizes[CACHE_TILES] == header.n_tiles * sizeof(TerrainTile);
+  if (!consistent) throw std::runtime_error("corrupt mesh cache: " + filename);
+  // Tiles are followed and drawn straight from the file, so each must point to later tiles and
+  // within the indices.
+  const TerrainTile* tiles = (const TerrainTile*) (file.Data() + header.offsets[CACHE_TILES]);
+  for (uint64_t t = 0; t < header.n_tiles; t++) {
+    const TerrainTile& tile = tiles[t];
+    bool valid = tile.first >= 0 && tile.count >= 0 &&
+      (uint64_t) tile.first + (uint64_t) tile.count <= header.n_indices;
+    for (int k = 0; k < 4; k++) {
+      int child = tile.children[k];
+      valid = valid && (child == -1 || (child >= 0 && (uint64_t) child > t && (uint64_t) child < header.n_tiles));
+    }
+    if (!valid) throw std::runtime_error("corrupt mesh cache: " + filename);
+  }
+  return header;
+}
+
+void WriteMeshCache(Rcpp::List object, std::string filename) {
+  bool animated = HasElement(object, "animation") ||
+    (object.containsElementNamed("update_buffer") && Rf_asLogical(object["update_buffer"]) == TRUE);
+  std::vector<float> vertices;
+  std::vector<GLuint> indices;
+  std::vector<int> color_columns;
+  std::vector<TerrainTile> tiles;
+  double tolerance = 0;
+
+  if (HasElement(object, "terrain")) {
+    Rcpp::List terrain = object["terrain"];
+    Rcpp::NumericMatrix relief = terrain["relief"], corners = terrain["corners"], color = object["color"];
+    Rcpp::NumericVector geotransform = terrain["geotransform"];
+    RasterGrid grid = MakeRasterGrid(relief, geotransform, corners, Rf_asLogical(terrain["globe"]) == TRUE,
+                                     Rf_asReal(terrain["radius"]));
+    tolerance = Rf_asReal(terrain["tolerance"]);
+    Terrain built(grid, color.begin(), color.nrow(), color.ncol(), tolerance, vertices, indices, color_columns);
+    tiles = built.Tiles();
+  } else {
+    // Animated objects are welded by index, as in unpack_mesh().
+    Rcpp::List mesh = UnpackMesh(object["positions"], object["indices"], object["normals"],
+                                 object["normal_indices"], object["color"], !animated);
+    Rcpp::NumericVector mesh_vertices = mesh["vertices"];
+    Rcpp::IntegerVector mesh_indices = mesh["indices"], mesh_columns = mesh["color_columns"];
+    vertices.assign(mesh_vertices.begin(), mesh_vertices.end());
+    indices.assign(mesh_indices.begin(), mesh_indices.end());
+    color_columns.assign(mesh_columns.begin(), mesh_columns.end());
+  }
+  if (!animated) color_columns.clear();
+
+  Rcpp::RawVector animation;
+  int n_cells = 0, n_frames = 0;
+  if (HasElement(object, "animation")) {
+    animation = Rcpp::as<Rcpp::RawVector>(object["animation"]);
+    Rcpp::IntegerVector dim = animation.attr("dim");
+    if (dim.size() != 3 || dim[0] != 4) Rcpp::stop("animation must have dimensions (4, n_cells, n_frames)");
+    n_cells = dim[1];
+    n_frames = dim[2];
+  }
+  SaveMeshCache(filename, vertices, indices, color_columns, n_frames > 0 ? animation.begin() : NULL, n_cells, n_frames,
+                tiles, tolerance);
+}
+
+void SaveMeshCache(const std::string& filename, const std::vector<float>& vertices, const std::vector<GLuint>& indices,
+                   const std::vector<int>& color_columns, const unsigned char* animation, int n_cells, int n_frames,
+                   const std::vector<TerrainTile>& tiles, double tolerance) {
+  MeshCacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = MESH_CACHE_VERSION;
+  header.byte_order = 1;
+  header.layout = VERTEX_COMPACT;
+  header.split_colors = !color_columns.empty();
+  header.n_vertices = vertices.size() / 10;
+  header.n_indices = indices.size();
+  header.n_cells = animation ? n_cells : 0;
+  header.n_frames = animation ? n_frames : 0;
+  header.n_tiles = tiles.size();
+  header.tolerance = tolerance;
+  Mesh::Bound(vertices, header.center, header.radius);
+
+  std::vector<unsigned char> packed = Mesh::Pack(vertices, header.layout, header.split_colors);
+  std::vector<unsigned char> colors;
+  if (header.split_colors) colors = Mesh::PackColors(vertices);
+  std::vector<int32_t> columns(color_columns.begin(), color_columns.end());
+  // 16-bit indices whenever every vertex can be reached with them, as in Mesh.
+  std::vector<GLushort> short_indices;
+  header.index_type = header.n_vertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  if (header.index_type == GL_UNSIGNED_SHORT) short_indices.assign(indices.begin(), indices.end());
+
+  const void* sections[N_CACHE_SECTIONS] = {
+    packed.data(),
+    header.index_type == GL_UNSIGNED_SHORT ? (const void*) short_indices.data() : (const void*) indices.data(),
+    colors.data(), columns.data(), animation, tiles.data()
+  };
+  header.sizes[CACHE_VERTICES] = packed.size();
+  header.sizes[CACHE_INDICES] = indices.size() * (header.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+  header.sizes[CACHE_COLORS] = colors.size();
+  header.sizes[CACHE_COLOR_COLUMNS] = columns.size() * sizeof(int32_t);
+  header.sizes[CACHE_ANIMATION] = 4 * header.n_cells * header.n_frames;
+  header.sizes[CACHE_TILES] = tiles.size() * sizeof(TerrainTile);
+  uint64_t offset = Align(sizeof(header));
+  for (int s = 0; s < N_CACHE_SECTIONS; s++) {
+    header.offsets[s] = offset;
+    offset = Align(offset + header.sizes[s]);
+  }
+
+  FILE* file = std::fopen(filename.c_str(), "wb");
+  if (file == NULL) throw std::runtime_error("cannot open file: " + filename);
+  const char padding[8] = {0};
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  uint64_t position = sizeof(header);
+  for (int s = 0; s < N_CACHE_SECTIONS && written; s++) {
+    written = std::fwrite(padding, 1, header.offsets[s] - position, file) == header.offsets[s] - position &&
+      (header.sizes[s] == 0 || std::fwrite(sections[s], 1, header.sizes[s], file) == header.sizes[s]);
+    position = header.offsets[s] + header.sizes[s];
+  }
+  written = std::fclose(file) == 0 && written;
+  if (!written) throw std::runtime_error("cannot write file: " + filename);
+}
+
+Rcpp::List MeshCacheInfo(std::string filename) {
+  MappedFile file(filename);
+  const MeshCacheHeader& header = CheckMeshCache(file, filename);
+  return Rcpp::List::create(
+    Rcpp::Named("vertices") = (double) header.n_vertices,
+    Rcpp::Named("triangles") = (double) header.n_indices / 3,
+    Rcpp::Named("frames") = (double) header.n_frames,
+    Rcpp::Named("tiles") = (double) header.n_tiles
+  );
+}
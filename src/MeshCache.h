@@ -0,0 +1,80 @@
+#ifndef MESH_CACHE
+#define MESH_CACHE
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Rcpp.h"
+#include "Terrain.h"
+
+const uint32_t MESH_CACHE_VERSION = 1;
+
+// Sections of a mesh cache file, in the order they follow the header.
+enum MeshCacheSection {
+  CACHE_VERTICES,      // vertices packed as by Mesh::Pack()
+  CACHE_INDICES,       // 16 or 32-bit triangle indices
+  CACHE_COLORS,        // RGBA bytes of each vertex, if colors are split
+  CACHE_COLOR_COLUMNS, // 32-bit color column of each vertex, if colors are split
+  CACHE_ANIMATION,     // RGBA bytes of n_cells cells in each of n_frames steps
+  CACHE_TILES,         // TerrainTile of each tile, root first
+  N_CACHE_SECTIONS
+};
+
+// Header of a mesh cache file: the buffers of one mesh as Mesh uploads them, so that they can be
+// mapped into memory and handed to OpenGL as they are. Every section starts at a multiple of 8 bytes.
+struct MeshCacheHeader {
+  char magic[8];                // "scnsmesh"
+  uint32_t version, byte_order; // MESH_CACHE_VERSION, and 1 as written by this machine
+  uint32_t layout, index_type;  // VertexLayout, and GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  uint32_t split_colors, reserved;
+  uint64_t n_vertices, n_indices;
+  uint64_t n_cells, n_frames;   // of the animation, 0 if none
+  uint64_t n_tiles;             // of the terrain, 0 if none
+  double center[3], radius;     // bounding sphere
+  double tolerance;             // of the terrain
+  uint64_t offsets[N_CACHE_SECTIONS], sizes[N_CACHE_SECTIONS];
+};
+
+// Whole file mapped read-only into memory for as long as the object lives.
+class MappedFile {
+public:
+  // Throws std::runtime_error if the file cannot be mapped.
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+
+  const unsigned char* Data() const { return data; }
+  size_t Size() const { return size; }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const unsigned char* data;
+  size_t size;
+#ifdef _WIN32
+  void* file;
+  void* mapping;
+#endif
+};
+
+// Header of a mapped mesh cache, after checking that it was written by this version on a machine of
+// the same byte order and that every section lies within the file. Throws std::runtime_error if not.
+const MeshCacheHeader& CheckMeshCache(const MappedFile& file, const std::string& filename);
+
+// Write the mesh a scenesetr_obj is drawn with to filename in VERTEX_COMPACT layout: the tiles of its
+// terrain, or otherwise its mesh as unpack_mesh() gives it, with the colors of every step of its animation.
+// Colors are split from positions and normals if the object is animated, as for InitAnimatedMesh().
+void WriteMeshCache(Rcpp::List object, std::string filename);
+
+// Write a mesh cache of vertices of 10 floats and triangle indices, with colors split if color_columns
+// gives the color column of each vertex. animation holds RGBA bytes of n_cells cells in each of n_frames
+// steps, or is NULL, and tiles are the tiles of a terrain, if any, with its tolerance.
+void SaveMeshCache(const std::string& filename, const std::vector<float>& vertices, const std::vector<GLuint>& indices,
+                   const std::vector<int>& color_columns, const unsigned char* animation, int n_cells, int n_frames,
+                   const std::vector<TerrainTile>& tiles, double tolerance);
+
+// Number of vertices, triangles, animation steps and terrain tiles in a mesh cache file.
+Rcpp::List MeshCacheInfo(std::string filename);
+
+#endif
@@ -0,0 +1,389 @@
+#include "MeshTools.h"
+#include "ThreadPool.h"
+
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int N_GEOMETRY = 5;
+const char* GEOMETRY[N_GEOMETRY] = {"positions", "indices", "normals", "normal_indices", "color"};
+
+// FNV-1a hash of the type, length and contents of an atomic vector.
+uint64_t HashVector(SEXP x) {
+  const unsigned char* bytes = NULL;
+  size_t size = 0;
+  switch (TYPEOF(x)) {
+  case REALSXP: bytes = (const unsigned char*) REAL(x); size = Rf_xlength(x) * sizeof(double); break;
+  case INTSXP: bytes = (const unsigned char*) INTEGER(x); size = Rf_xlength(x) * sizeof(int); break;
+  case LGLSXP: bytes = (const unsigned char*) LOGICAL(x); size = Rf_xlength(x) * sizeof(int); break;
+  }
+  uint64_t hash = 14695981039346656037ULL;
+  hash = (hash ^ TYPEOF(x)) * 1099511628211ULL;
+  hash = (hash ^ Rf_xlength(x)) * 1099511628211ULL;
+  for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  return hash;
+}
+
+const int VERTEX_FLOATS = 10;
+
+struct VertexKey {
+  float values[VERTEX_FLOATS];
+  bool operator==(const VertexKey& other) const {
+    return std::memcmp(values, other.values, sizeof(values)) == 0;
+  }
+};
+
+struct CornerKey {
+  int position, normal, color;
+  bool operator==(const CornerKey& other) const {
+    return position == other.position && normal == other.normal && color == other.color;
+  }
+};
+
+struct KeyHash {
+  template <typename Key> size_t operator()(const Key& key) const {
+    const unsigned char* bytes = (const unsigned char*) &key;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(Key); i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+  }
+};
+
+// Column j of a 1-based index matrix as 0-based, or -1 if NA or out of range.
+inline int Column(int index, int ncol) {
+  return index == NA_INTEGER || index < 1 || index > ncol ? -1 : index - 1;
+}
+
+inline void CopyColumn(const Rcpp::NumericMatrix& x, int j, int n, float* out) {
+  for (int i = 0; i < n; i++) out[i] = j < 0 ? NAN : x[j * x.nrow() + i];
+}
+
+// Newell's method over the first n corners of a face, as in add_normals(), normalised.
+// Faces with a missing corner have a NaN normal.
+void NewellNormal(const double* positions, const int* face, int n, double* out) {
+  out[0] = out[1] = out[2] = 0;
+  for (int k = 0; k < n; k++) {
+    int a = face[k], b = face[(k + 1) % n];
+    if (a == NA_INTEGER || b == NA_INTEGER) {
+      out[0] = out[1] = out[2] = NAN;
+      return;
+    }
+    const double* p = positions + 3 * (a - 1);
+    const double* q = positions + 3 * (b - 1);
+    out[0] += (p[1] - q[1]) * (p[2] + q[2]);
+    out[1] += (p[2] - q[2]) * (p[0] + q[0]);
+    out[2] += (p[0] - q[0]) * (p[1] + q[1]);
+  }
+  double length = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+  for (int c = 0; c < 3; c++) out[c] /= length;
+}
+
+// Triangles of a face of n corners, as 3 * (n - 2) positions within the face, keeping its winding.
+// Convex faces are split into a fan as triangulate() split quads, the first triangle 1-2-3 and the
+// rest k-(k + 1)-1. Other faces are projected onto the plane of their normal and their ears clipped.
+void TriangulateFace(const double* positions, const int* face, int n, int* out, 
+                     std::vector<double>& x, std::vector<double>& y, std::vector<int>& remaining) {
+  double normal[3];
+  NewellNormal(positions, face, n, normal);
+  // Drop the axis the normal is closest to, so the remaining two keep the winding if it points along +axis.
+  int axis = 0;
+  for (int c = 1; c < 3; c++) if (std::fabs(normal[c]) > std::fabs(normal[axis])) axis = c;
+  double sign = normal[axis] < 0 ? -1 : 1;
+  x.resize(n);
+  y.resize(n);
+  for (int k = 0; k < n; k++) {
+    const double* p = positions + 3 * (face[k] - 1);
+    x[k] = p[(axis + 1) % 3];
+    y[k] = p[(axis + 2) % 3];
+  }
+  // Twice the area of triangle a-b-c, positive if it turns the same way as the face.
+  auto Turn = [&](int a, int b, int c) {
+    return sign * ((x[b] - x[a]) * (y[c] - y[a]) - (y[b] - y[a]) * (x[c] - x[a]));
+  };
+  
+  bool convex = !ISNAN(normal[0]);
+  for (int k = 0; k < n && convex; k++) convex = Turn((k + n - 1) % n, k, (k + 1) % n) >= 0;
+  if (convex || n == 3) {
+    int first[3] = {0, 1, 2};
+    std::copy(first, first + 3, out);
+    for (int k = 2; k < n - 1; k++) {
+      int* t = out + 3 * (k - 1);
+      t[0] = k;
+      t[1] = k + 1;
+      t[2] = 0;
+    }
+    return;
+  }
+  
+  remaining.resize(n);
+  for (int k = 0; k < n; k++) remaining[k] = k;
+  while (remaining.size() > 3) {
+    int m = remaining.size(), ear = -1;
+    for (int i = 0; i < m && ear < 0; i++) {
+      int a = remaining[(i + m - 1) % m], b = remaining[i], c = remaining[(i + 1) % m];
+      if (Turn(a, b, c) <= 0) continue;
+      bool empty = true;
+      for (int j = 0; j < m && empty; j++) {
+        int p = remaining[j];
+        if (p == a || p == b || p == c) continue;
+        // A corner on the edge of the ear counts as inside, as its diagonal would run along the boundary.
+        empty = !(Turn(a, b, p) >= 0 && Turn(b, c, p) >= 0 && Turn(c, a, p) >= 0);
+      }
+      if (empty) ear = i;
+    }
+    // A self-intersecting or degenerate face may have no ear left, so clip any corner to finish.
+    if (ear < 0) ear = 0;
+    out[0] = remaining[(ear + m - 1) % m];
+    out[1] = remaining[ear];
+    out[2] = remaining[(ear + 1) % m];
+    out += 3;
+    remaining.erase(remaining.begin() + ear);
+  }
+  std::copy(remaining.begin(), remaining.end(), out);
+}
+
+template <typename Key>
+int Weld(const Key& key, const float* vertex, int color_column, std::unordered_map<Key, int, KeyHash>& welded, 
+         std::vector<double>& vertices, std::vector<int>& color_columns) {
+  std::pair<typename std::unordered_map<Key, int, KeyHash>::iterator, bool> found = 
+    welded.insert(std::make_pair(key, (int) welded.size()));
+  if (found.second) {
+    vertices.insert(vertices.end(), vertex, vertex + VERTEX_FLOATS);
+    color_columns.push_back(color_column);
+  }
+  return found.first->second;
+}
+
+}
+
+Rcpp::List UnpackMesh(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices, Rcpp::NumericMatrix normals, 
+                      Rcpp::IntegerMatrix normal_indices, Rcpp::NumericMatrix color, bool by_value) {
+  int n_corners = indices.size();
+  int color_rows = color.nrow(), color_cols = color.ncol();
+  if (normal_indices.size() != n_corners) Rcpp::stop("indices and normal_indices must be the same size");
+  
+  std::vector<double> vertices;
+  std::vector<int> color_columns;
+  Rcpp::IntegerVector out_indices(n_corners);
+  std::unordered_map<VertexKey, int, KeyHash> by_vertex;
+  std::unordered_map<CornerKey, int, KeyHash> by_corner;
+  if (by_value) by_vertex.reserve(n_corners); else by_corner.reserve(n_corners);
+  
+  for (int k = 0; k < n_corners; k++) {
+    CornerKey corner;
+    corner.position = Column(indices[k], positions.ncol());
+    corner.normal = Column(normal_indices[k], normals.ncol());
+    // One color for the whole object, or one per triangle, recycled as R would.
+    corner.color = color_cols == 1 ? 0 : (k / 3) % color_cols;
+    
+    VertexKey vertex;
+    CopyColumn(positions, corner.position, 3, vertex.values);
+    CopyColumn(normals, corner.normal, 3, vertex.values + 3);
+    for (int i = 0; i < 4; i++) {
+      vertex.values[6 + i] = i < color_rows ? color[corner.color * color_rows + i] / 255 : 1;
+    }
+    
+    out_indices[k] = by_value ? Weld(vertex, vertex.values, corner.color, by_vertex, vertices, color_columns) : 
+      Weld(corner, vertex.values, corner.color, by_corner, vertices, color_columns);
+  }
+  
+  return Rcpp::List::create(
+    Rcpp::Named("vertices") = Rcpp::NumericVector(vertices.begin(), vertices.end()),
+    Rcpp::Named("indices") = out_indices,
+    Rcpp::Named("color_columns") = Rcpp::IntegerVector(color_columns.begin(), color_columns.end())
+  );
+}
+
+Rcpp::IntegerVector SharedMeshes(Rcpp::List objects) {
+  int n = objects.size();
+  Rcpp::IntegerVector out(n);
+  std::vector<std::vector<SEXP> > geometry(n, std::vector<SEXP>(N_GEOMETRY));
+  std::unordered_map<SEXP, uint64_t> hashes;  // copies of an object share their vectors
+  std::multimap<uint64_t, int> first_uses;
+  std::map<std::string, int> cached;
+  int n_meshes = 0;
+  
+  for (int i = 0; i < n; i++) {
+    Rcpp::List object = objects[i];
+    bool animated = object.containsElementNamed("animation") && !Rf_isNull(object["animation"]);
+    bool terrain = object.containsElementNamed("terrain") && !Rf_isNull(object["terrain"]);
+    if (object.containsElementNamed("cache") && !Rf_isNull(object["cache"])) {
+      // Cached objects share the mesh of their file.
+      Rcpp::List cache = object["cache"];
+      std::string file = Rcpp::as<std::string>(cache["file"]);
+      std::map<std::string, int>::iterator found = cached.find(file);
+      if (found == cached.end()) found = cached.insert(std::make_pair(file, n_meshes++)).first;
+      out[i] = found->second;
+      continue;
+    }
+    if (animated || terrain || (object.containsElementNamed("update_buffer") && Rf_asLogical(object["update_buffer"]) == TRUE)) {
+      out[i] = n_meshes++;
+      continue;
+    }
+    
+    uint64_t hash = 0;
+    for (int k = 0; k < N_GEOMETRY; k++) {
+      SEXP x = object[GEOMETRY[k]];
+      geometry[i][k] = x;
+      std::unordered_map<SEXP, uint64_t>::iterator cached = hashes.find(x);
+      if (cached == hashes.end()) cached = hashes.insert(std::make_pair(x, HashVector(x))).first;
+      hash = (hash ^ cached->second) * 1099511628211ULL;
+    }
+    
+    bool found = false;
+    std::pair<std::multimap<uint64_t, int>::iterator, std::multimap<uint64_t, int>::iterator> 
+      candidates = first_uses.equal_range(hash);
+    for (std::multimap<uint64_t, int>::iterator it = candidates.first; it != candidates.second && !found; ++it) {
+      int j = it->second;
+      found = true;
+      for (int k = 0; k < N_GEOMETRY && found; k++) {
+        SEXP a = geometry[i][k], b = geometry[j][k];
+        found = a == b || R_compute_identical(a, b, 16);
+      }
+      if (found) out[i] = out[j];
+    }
+    if (!found) {
+      first_uses.insert(std::make_pair(hash, i));
+      out[i] = n_meshes++;
+    }
+  }
+  return out;
+}
+
+Rcpp::List FaceNormals(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices, bool smooth) {
+  int max_sides = indices.nrow(), n_faces = indices.ncol(), n_points = positions.ncol();
+  if (positions.nrow() != 3) Rcpp::stop("positions must have 3 rows");
+  const double* points = positions.begin();
+  const int* faces = indices.begin();
+  for (R_xlen_t k = 0; k < indices.size(); k++) {
+    if (faces[k] != NA_INTEGER && (faces[k] < 1 || faces[k] > n_points)) Rcpp::stop("indices out of range");
+  }
+  
+  // A face has as many corners as it has indices that are not NA, as colSums(!is.na(indices)).
+  ThreadPool pool;
+  Rcpp::NumericMatrix face_normals(3, n_faces);
+  double* normals = face_normals.begin();
+  pool.ParallelFor(n_faces, [&](int from, int to) {
+    for (int f = from; f < to; f++) {
+      const int* face = faces + (size_t) f * max_sides;
+      int sides = 0;
+      for (int k = 0; k < max_sides; k++) sides += face[k] != NA_INTEGER;
+      NewellNormal(points, face, sides, normals + 3 * f);
+    }
+  });
+  
+  if (!smooth) {
+    Rcpp::IntegerMatrix normal_indices(max_sides, n_faces);
+    for (int f = 0; f < n_faces; f++) std::fill_n(normal_indices.begin() + (size_t) f * max_sides, max_sides, f + 1);
+    return Rcpp::List::create(
+      Rcpp::Named("normals") = face_normals,
+      Rcpp::Named("normal_indices") = normal_indices
+    );
+  }
+  
+  // Scatter face normals into one accumulator per thread, counting a face once per point it contains.
+  int n_threads = std::max(1, std::min(pool.Size(), n_faces));
+  std::vector<std::vector<double> > sums(n_threads);
+  for (int t = 0; t < n_threads; t++) {
+    pool.Submit([&, t] {
+      std::vector<double>& sum = sums[t];
+      sum.assign(3 * (size_t) n_points, 0);
+      for (int f = (int) ((double) n_faces * t / n_threads); f < (int) ((double) n_faces * (t + 1) / n_threads); f++) {
+        const int* face = faces + (size_t) f * max_sides;
+        const double* normal = normals + 3 * f;
+        for (int k = 0; k < max_sides; k++) {
+          if (face[k] == NA_INTEGER || std::find(face, face + k, face[k]) != face + k) continue;
+          for (int c = 0; c < 3; c++) sum[3 * (face[k] - 1) + c] += normal[c];
+        }
+      }
+    });
+  }
+  pool.Wait();
+  
+  Rcpp::NumericMatrix point_normals(3, n_points);
+  double* out = point_normals.begin();
+  pool.ParallelFor(n_points, [&](int from, int to) {
+    for (int i = from; i < to; i++) {
+      double* normal = out + 3 * i;
+      for (int c = 0; c < 3; c++) {
+        normal[c] = 0;
+        for (int t = 0; t < n_threads; t++) normal[c] += sums[t][3 * i + c];
+      }
+      double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+      for (int c = 0; c < 3; c++) normal[c] /= length;
+    }
+  });
+  
+  return Rcpp::List::create(
+    Rcpp::Named("normals") = point_normals,
+    Rcpp::Named("normal_indices") = indices
+  );
+}
+
+Rcpp::List Triangulate(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices) {
+  int max_sides = indices.nrow(), n_faces = indices.ncol(), n_points = positions.ncol();
+  if (positions.nrow() != 3) Rcpp::stop("positions must have 3 rows");
+  const double* points = positions.begin();
+  const int* faces = indices.begin();
+  for (R_xlen_t k = 0; k < indices.size(); k++) {
+    if (faces[k] != NA_INTEGER && (faces[k] < 1 || faces[k] > n_points)) Rcpp::stop("indices out of range");
+  }
+  
+  // Each face of n corners, the indices before the first NA, gives n - 2 triangles.
+  std::vector<int> sides(n_faces), first(n_faces + 1, 0);
+  int max_triangles = 0;
+  for (int f = 0; f < n_faces; f++) {
+    const int* face = faces + (size_t) f * max_sides;
+    int n = 0;
+    while (n < max_sides && face[n] != NA_INTEGER) n++;
+    sides[f] = n;
+    first[f + 1] = first[f] + std::max(0, n - 2);
+    max_triangles = std::max(max_triangles, n - 2);
+  }
+  int n_triangles = first[n_faces];
+  
+  ThreadPool pool;
+  std::vector<int> corners(3 * (size_t) n_triangles);
+  pool.ParallelFor(n_faces, [&](int from, int to) {
+    std::vector<double> x, y;
+    std::vector<int> remaining;
+    for (int f = from; f < to; f++) {
+      if (sides[f] < 3) continue;
+      TriangulateFace(points, faces + (size_t) f * max_sides, sides[f], corners.data() + 3 * (size_t) first[f], x, y, remaining);
+    }
+  });
+  
+  // Order the triangles by their rank within their face, all first triangles then all second triangles 
+  // and so on, so that triangles and quads come out as triangulate() gave them.
+  std::vector<int> next(max_triangles + 1, 0);
+  for (int f = 0; f < n_faces; f++) {
+    for (int r = 0; r < first[f + 1] - first[f]; r++) next[r + 1]++;
+  }
+  for (int r = 0; r < max_triangles; r++) next[r + 1] += next[r];
+  
+  Rcpp::IntegerMatrix out_indices(3, n_triangles), out_corners(3, n_triangles);
+  Rcpp::IntegerVector out_faces(n_triangles);
+  for (int f = 0; f < n_faces; f++) {
+    const int* face = faces + (size_t) f * max_sides;
+    for (int r = 0; r < first[f + 1] - first[f]; r++) {
+      int t = next[r]++;
+      const int* corner = corners.data() + 3 * (size_t) (first[f] + r);
+      for (int k = 0; k < 3; k++) {
+        out_indices[3 * t + k] = face[corner[k]];
+        out_corners[3 * t + k] = f * max_sides + corner[k] + 1;
+      }
+      out_faces[t] = f + 1;
+    }
+  }
+  
+  return Rcpp::List::create(
+    Rcpp::Named("indices") = out_indices,
+    Rcpp::Named("faces") = out_faces,
+    Rcpp::Named("corners") = out_corners
+  );
+}
@@ -0,0 +1,33 @@
+#ifndef MESH_TOOLS
+#define MESH_TOOLS
+
+#include "Rcpp.h"
+
+// Mesh of each object in a list of scenesetr_obj, numbered from 0 in order of first use.
+// Objects with identical positions, indices, normals, normal_indices and color share a mesh,
+// unless they are animated, drawn as terrain or their buffer is updated. Objects read from the same
+// mesh cache file share its mesh.
+Rcpp::IntegerVector SharedMeshes(Rcpp::List objects);
+
+// Interleaved vertices (position, normal, RGBA color, 10 per vertex) and 0-based triangle indices 
+// of a triangulated object. Corners with equal vertices share one, compared by value if by_value, 
+// or otherwise by their position index, normal index and color column, which keeps the vertices
+// in the same order whatever the colors. color_columns gives the 0-based column of color of each vertex.
+Rcpp::List UnpackMesh(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices, Rcpp::NumericMatrix normals, 
+                      Rcpp::IntegerMatrix normal_indices, Rcpp::NumericMatrix color, bool by_value);
+
+// Newell normal of each face of a scenesetr_obj, with one column of indices per face padded by NA,
+// and the normal_indices giving the normal of each corner. If smooth, each point instead takes the
+// normalised mean of the normals of the faces containing it, and normal_indices are the indices.
+// Faces are split across threads, each summing smooth normals into its own accumulator.
+Rcpp::List FaceNormals(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices, bool smooth);
+
+// Triangles of each face of a scenesetr_obj, with one column of indices per face padded by NA. 
+// Convex faces are split into a fan and others by ear clipping, faces split across threads.
+// Returns the indices of the triangles, the 1-based face of each triangle, and the corners,
+// the 1-based position in indices of each index of the triangles. Faces with fewer than three
+// corners give no triangles. Triangles are ordered by their rank within their face, so that 
+// the first triangle of every face comes before any second triangle.
+Rcpp::List Triangulate(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices);
+
+#endif
@@ -0,0 +1,181 @@
+#include "ObjReader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+
+struct ObjParser {
+  std::vector<ObjData> objects;
+  long n_vertices = 0, n_normals = 0;      // running totals over the whole file
+  long vertex_offset = 0, normal_offset = 0; // totals when the current object began
+
+  ObjParser() {
+    // Records before the first "o" belong to an unnamed object.
+    objects.push_back(ObjData());
+  }
+
+  static const char* SkipSpace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+  }
+
+  static const char* SkipToken(const char* p, const char* end) {
+    while (p < end && *p != ' ' && *p != '\t') p++;
+    return p;
+  }
+
+  // Resolve a 1-based or negative .obj index to an index local to the current object.
+  static int Resolve(long index, long total, long offset) {
+    if (index < 0) index += total + 1;
+    return (int) (index - offset);
+  }
+
+  void ReadTriple(const char* p, const char* end, std::vector<double>& out) {
+    // strtod stops at the line end, which is always followed by a terminator.
+    char* next;
+    for (int i = 0; i < 3; i++) {
+      p = SkipSpace(p, end);
+      double value = p < end ? std::strtod(p, &next) : NA_REAL;
+      if (p < end && next == p) value = NA_REAL;
+      else if (p < end) p = next;
+      out.push_back(value);
+    }
+  }
+
+  // Read an integer starting exactly at p, leaving value untouched if there is none.
+  static const char* ReadIndex(const char* p, const char* end, long& value) {
+    if (p == end || !(std::isdigit((unsigned char) *p) || *p == '-' || *p == '+')) return p;
+    char* next;
+    value = std::strtol(p, &next, 10);
+    return next;
+  }
+
+  void ReadFace(const char* p, const char* end) {
+    ObjData& object = objects.back();
+    int sides = 0;
+    while ((p = SkipSpace(p, end)) < end) {
+      long v = 0, vt = 0, vn = 0;
+      const char* next = ReadIndex(p, end, v);
+      if (next == p) break;
+      p = next;
+      if (p < end && *p == '/') {
+        p = ReadIndex(p + 1, end, vt); // texture coordinates are ignored
+        if (p < end && *p == '/') p = ReadIndex(p + 1, end, vn);
+      }
+      p = SkipToken(p, end);
+      object.corners.push_back(Resolve(v, n_vertices, vertex_offset));
+      if (vn != 0) {
+        object.normal_corners.push_back(Resolve(vn, n_normals, normal_offset));
+        object.has_normal_indices = true;
+      } else {
+        object.normal_corners.push_back(0);
+      }
+      sides++;
+    }
+    object.sides.push_back(sides);
+  }
+
+  void ParseLine(const char* p, const char* end) {
+    while (end > p && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+    p = SkipSpace(p, end);
+    const char* key_end = SkipToken(p, end);
+    size_t key_length = key_end - p;
+    if (key_length == 1 && *p == 'v') {
+      ReadTriple(key_end, end, objects.back().positions);
+      n_vertices++;
+    } else if (key_length == 2 && p[0] == 'v' && p[1] == 'n') {
+      ReadTriple(key_end, end, objects.back().normals);
+      n_normals++;
+    } else if (key_length == 1 && *p == 'f') {
+      ReadFace(key_end, end);
+    } else if (key_length == 1 && *p == 'o') {
+      const char* name = SkipSpace(key_end, end);
+      objects.push_back(ObjData());
+      objects.back().name.assign(name, SkipToken(name, end));
+      vertex_offset = n_vertices;
+      normal_offset = n_normals;
+    }
+  }
+};
+
+}
+
+std::vector<ObjData> ParseObj(const char* filename) {
+  FILE* file = std::fopen(filename, "rb");
+  if (file == NULL) throw std::runtime_error(std::string("cannot open file: ") + filename);
+
+  ObjParser parser;
+  const size_t chunk_size = 1 << 20;
+  std::vector<char> buffer(chunk_size + 1);
+  size_t carried = 0;
+
+  // Stream the file in chunks, carrying any incomplete last line over to the next chunk.
+  for (;;) {
+    if (carried == buffer.size() - 1) buffer.resize(2 * buffer.size());
+    size_t n_read = std::fread(buffer.data() + carried, 1, buffer.size() - 1 - carried, file);
+    size_t filled = carried + n_read;
+    bool at_end = n_read == 0;
+    buffer[filled] = '\n';
+
+    const char* line = buffer.data();
+    const char* stop = buffer.data() + filled;
+    for (;;) {
+      const char* newline = static_cast<const char*>(std::memchr(line, '\n', stop - line + 1));
+      if (newline == stop && !at_end) break;
+      parser.ParseLine(line, newline);
+      line = newline + 1;
+      if (line > stop) break;
+    }
+    if (at_end) break;
+    carried = stop - line;
+    std::memmove(buffer.data(), line, carried);
+  }
+  std::fclose(file);
+
+  std::vector<ObjData>& objects = parser.objects;
+  if (objects.front().sides.empty() && objects.size() > 1) objects.erase(objects.begin());
+  return objects;
+}
+
+// Fill a face matrix with one column per face, padded with NA.
+Rcpp::IntegerMatrix FaceMatrix(const std::vector<int>& corners, const std::vector<int>& sides, int max_sides) {
+  Rcpp::IntegerMatrix out(max_sides, sides.size());
+  std::fill(out.begin(), out.end(), NA_INTEGER);
+  size_t k = 0;
+  for (size_t f = 0; f < sides.size(); f++) {
+    for (int s = 0; s < sides[f]; s++, k++) {
+      out[f * max_sides + s] = corners[k] > 0 ? corners[k] : NA_INTEGER;
+    }
+  }
+  return out;
+}
+
+Rcpp::List ReadObj(std::string filename) {
+  std::vector<ObjData> objects = ParseObj(filename.c_str());
+  Rcpp::List out(objects.size());
+  Rcpp::CharacterVector names(objects.size());
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    ObjData& object = objects[i];
+    int max_sides = object.sides.empty() ? 0 : *std::max_element(object.sides.begin(), object.sides.end());
+
+    Rcpp::NumericMatrix positions(3, object.positions.size() / 3, object.positions.begin());
+    Rcpp::NumericMatrix normals(3, object.normals.size() / 3, object.normals.begin());
+
+    out[i] = Rcpp::List::create(
+      Rcpp::Named("positions") = positions,
+      Rcpp::Named("normals") = normals,
+      Rcpp::Named("indices") = FaceMatrix(object.corners, object.sides, max_sides),
+      Rcpp::Named("normal_indices") = FaceMatrix(object.normal_corners, object.sides, max_sides),
+      Rcpp::Named("has_normal_indices") = object.has_normal_indices
+    );
+    names[i] = object.name;
+  }
+  out.attr("names") = names;
+  return out;
+}
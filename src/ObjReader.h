@@ -0,0 +1,28 @@
+#ifndef OBJ_READER
+#define OBJ_READER
+
+#include <string>
+#include <vector>
+#include "Rcpp.h"
+
+// Geometry of one object ("o" block) of a .obj file.
+// Face indices are 1-based and local to the object.
+struct ObjData {
+  std::string name;
+  std::vector<double> positions;    // 3 per vertex
+  std::vector<double> normals;      // 3 per normal
+  std::vector<int> corners;         // vertex index of each face corner
+  std::vector<int> normal_corners;  // normal index of each face corner, 0 if absent
+  std::vector<int> sides;           // number of corners of each face
+  bool has_normal_indices = false;
+};
+
+// Single pass over a .obj file, reading v, vn and f records of every object.
+// Faces may be given as v, v/vt, v//vn or v/vt/vn with negative (relative) indices.
+// Throws std::runtime_error if the file cannot be read.
+std::vector<ObjData> ParseObj(const char* filename);
+
+// List of the positions, normals, indices and normal_indices of each object, named by object.
+Rcpp::List ReadObj(std::string filename);
+
+#endif
@@ -0,0 +1,113 @@
+#include "OffscreenContext.h"
+
+#ifdef SCENESETR_EGL
+
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+EGLDisplay GetDisplay() {
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay != NULL) {
+    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display != EGL_NO_DISPLAY) return display;
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+}
+
+bool OffscreenContext::Create() {
+  if (TryCreate()) return true;
+  // No usable device: fall back to llvmpipe. Mesa reads the variable when the display is
+  // initialised, so restore it afterwards rather than forcing every later context onto software.
+  const char* previous = getenv("LIBGL_ALWAYS_SOFTWARE");
+  std::string saved = previous ? previous : "";
+  setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+  bool created = TryCreate();
+  if (previous) {
+    setenv("LIBGL_ALWAYS_SOFTWARE", saved.c_str(), 1);
+  } else {
+    unsetenv("LIBGL_ALWAYS_SOFTWARE");
+  }
+  return created;
+}
+
+bool OffscreenContext::TryCreate() {
+  EGLDisplay eglDisplay = GetDisplay();
+  if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, NULL, NULL)) return false;
+  display = eglDisplay;
+  
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    Delete();
+    return false;
+  }
+  
+  const EGLint config_attributes[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint n_configs = 0;
+  if (!eglChooseConfig(eglDisplay, config_attributes, &config, 1, &n_configs) || n_configs == 0) {
+    config = EGL_NO_CONFIG_KHR;
+  }
+  
+  const EGLint context_attributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+    EGL_NONE
+  };
+  EGLContext eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, context_attributes);
+  if (eglContext == EGL_NO_CONTEXT) {
+    Delete();
+    return false;
+  }
+  context = eglContext;
+  
+  // Rendering goes to a framebuffer object, so no surface is needed if the 
+  // driver allows it. Otherwise bind a minimal pbuffer.
+  if (eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) return true;
+  if (config != EGL_NO_CONFIG_KHR) {
+    const EGLint pbuffer_attributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    EGLSurface eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbuffer_attributes);
+    if (eglSurface != EGL_NO_SURFACE) {
+      surface = eglSurface;
+      if (eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) return true;
+    }
+  }
+  Delete();
+  return false;
+}
+
+void OffscreenContext::Delete() {
+  if (display == nullptr) return;
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (surface != nullptr) eglDestroySurface(display, surface);
+  if (context != nullptr) eglDestroyContext(display, context);
+  eglTerminate(display);
+  display = context = surface = nullptr;
+}
+
+void* OffscreenContext::GetProcAddress(const char* name) {
+  return (void*) eglGetProcAddress(name);
+}
+
+#else
+
+bool OffscreenContext::Create() { return false; }
+bool OffscreenContext::TryCreate() { return false; }
+void OffscreenContext::Delete() {}
+void* OffscreenContext::GetProcAddress(const char* name) { return nullptr; }
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef OFFSCREEN_CONTEXT
+#define OFFSCREEN_CONTEXT
+
+// Windowless OpenGL 3.3 core context for headless rendering.
+// Uses EGL on a surfaceless (or 1x1 pbuffer) display, retrying with Mesa's 
+// software rasterizer (llvmpipe) if no hardware context can be created.
+// Only available where the package is built with SCENESETR_EGL.
+class OffscreenContext {
+public:
+  // Create the context and make it current. Returns false on failure.
+  bool Create();
+
+  // Release the context and the display.
+  void Delete();
+
+  // Loader passed to gladLoadGLLoader.
+  static void* GetProcAddress(const char* name);
+
+private:
+  bool TryCreate();
+  void* display = nullptr;
+  void* context = nullptr;
+  void* surface = nullptr;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef QUATERNION
+#define QUATERNION
+
+#include <cmath>
+
+const double QUATERNION_PI = 3.14159265358979323846;
+
+// Native counterparts of R/quaternion.R. Quaternions are (w, x, y, z),
+// vectors are (x, y, z), and NaN marks a missing position or orientation.
+
+inline bool AnyNaN(const double* x, int n) {
+  for (int i = 0; i < n; i++) if (std::isnan(x[i])) return true;
+  return false;
+}
+
+inline void Normalise(double* x, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; i++) sum += x[i] * x[i];
+  double length = std::sqrt(sum);
+  for (int i = 0; i < n; i++) x[i] /= length;
+}
+
+// q1 %q% q2
+inline void QMultiply(const double* q1, const double* q2, double* out) {
+  double w = q1[0]*q2[0] - q1[1]*q2[1] - q1[2]*q2[2] - q1[3]*q2[3];
+  double x = q1[0]*q2[1] + q1[1]*q2[0] + q1[2]*q2[3] - q1[3]*q2[2];
+  double y = q1[0]*q2[2] - q1[1]*q2[3] + q1[2]*q2[0] + q1[3]*q2[1];
+  double z = q1[0]*q2[3] + q1[1]*q2[2] - q1[2]*q2[1] + q1[3]*q2[0];
+  out[0] = w; out[1] = x; out[2] = y; out[3] = z;
+}
+
+// q %qcross% p
+inline void QCross(const double* q, const double* p, double* out) {
+  double x = q[2]*p[2] - q[3]*p[1];
+  double y = q[3]*p[0] - q[1]*p[2];
+  double z = q[1]*p[1] - q[2]*p[0];
+  out[0] = x; out[1] = y; out[2] = z;
+}
+
+// q %rot% p: rotate vector p by quaternion q.
+inline void QRotate(const double* q, const double* p, double* out) {
+  double t[3], u[3];
+  QCross(q, p, t);
+  for (int i = 0; i < 3; i++) t[i] *= 2;
+  QCross(q, t, u);
+  for (int i = 0; i < 3; i++) out[i] = p[i] + q[0] * t[i] + u[i];
+}
+
+inline void Q2Dir(const double* q, double* out) {
+  const double z[3] = {0, 0, 1};
+  QRotate(q, z, out);
+}
+
+inline void Quaternion(const double* axis, double angle, double* out) {
+  out[0] = std::cos(angle);
+  for (int i = 0; i < 3; i++) out[i + 1] = axis[i] * std::sin(angle);
+}
+
+inline void Dir2Q(const double* direction, double* out) {
+  if (AnyNaN(direction, 3)) {
+    for (int i = 0; i < 4; i++) out[i] = NAN;
+    return;
+  }
+  if (direction[0] + direction[1] + direction[2] == 0) {
+    out[0] = 1; out[1] = out[2] = out[3] = 0;
+    return;
+  }
+  double dir[3] = {direction[0], direction[1], direction[2]};
+  Normalise(dir, 3);
+  const double up[3] = {0, 1, 0};
+  double yaw[4], yawed[3];
+  Quaternion(up, std::atan2(dir[0], dir[2]) / 2, yaw);
+  Q2Dir(yaw, yawed);
+  double pitch_axis[3] = {-yawed[2], 0, yawed[0]};
+  double pitch[4];
+  Quaternion(pitch_axis, std::atan2(dir[1], std::sqrt(dir[0]*dir[0] + dir[2]*dir[2])) / 2, pitch);
+  QMultiply(pitch, yaw, out);
+}
+
+// Rotation of q about its own direction.
+inline void Roll(const double* q, double* out) {
+  double dir[3], upright[4];
+  Q2Dir(q, dir);
+  Dir2Q(dir, upright);
+  for (int i = 1; i < 4; i++) upright[i] = -upright[i];
+  QMultiply(q, upright, out);
+}
+
+// Directions accepted by skewer().
+enum SkewerDirection { SKEWER_UP, SKEWER_DOWN, SKEWER_LEFT, SKEWER_RIGHT, SKEWER_CLOCKWISE };
+
+// skewer(x, direction, to_rotate = TRUE) for an element with orientation q.
+inline void SkewerToRotate(const double* q, int direction, double* out) {
+  double d[3], axis[3], roll[4];
+  Q2Dir(q, d);
+  switch (direction) {
+  case SKEWER_UP: axis[0] = -d[2]; axis[1] = 0; axis[2] = d[0]; break;
+  case SKEWER_DOWN: axis[0] = d[2]; axis[1] = 0; axis[2] = -d[0]; break;
+  case SKEWER_RIGHT: axis[0] = d[0]*d[1]; axis[1] = -(d[0]*d[0] + d[2]*d[2]); axis[2] = d[1]*d[2]; break;
+  case SKEWER_LEFT: axis[0] = -d[0]*d[1]; axis[1] = d[0]*d[0] + d[2]*d[2]; axis[2] = -d[1]*d[2]; break;
+  default: axis[0] = d[0]; axis[1] = d[1]; axis[2] = d[2];
+  }
+  Roll(q, roll);
+  QRotate(roll, axis, out);
+}
+
+// rotate(x, axis, angle) applied to orientation q in place. 
+// If direction is not negative, axis is ignored and found by SkewerToRotate().
+inline void RotateOrientation(double* q, const double* axis, int direction, double angle) {
+  if (AnyNaN(q, 4)) return;
+  double a[3] = {axis[0], axis[1], axis[2]};
+  if (direction >= 0) SkewerToRotate(q, direction, a);
+  if (a[0] + a[1] + a[2] == 0) return;
+  Normalise(a, 3);
+  double turn = QUATERNION_PI * angle / 360;
+  double r[4] = {std::cos(turn), a[0] * std::sin(turn), a[1] * std::sin(turn), a[2] * std::sin(turn)};
+  QMultiply(r, q, q);
+}
+
+#endif
@@ -12,9 +12,11 @@ Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 
 
 RcppExport SEXP _rcpp_module_boot_GLRenderer();
+RcppExport SEXP _rcpp_module_boot_MeshTools();
 
 static const R_CallMethodDef CallEntries[] = {
     {"_rcpp_module_boot_GLRenderer", (DL_FUNC) &_rcpp_module_boot_GLRenderer, 0},
+    {"_rcpp_module_boot_MeshTools", (DL_FUNC) &_rcpp_module_boot_MeshTools, 0},
     {NULL, NULL, 0}
 };
 
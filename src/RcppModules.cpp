@@ -1,23 +1,59 @@
 #include "GLRenderer.h"
+#include "ObjReader.h"
+#include "MeshTools.h"
+#include "GridMesh.h"
+#include "Simplify.h"
+#include "MeshCache.h"
 
 using namespace Rcpp;
 
 RCPP_MODULE(GLRenderer) {
   class_<GLRenderer>("GLRenderer")
   .constructor<const char*, int, int>()
+  .constructor<const char*, int, int, bool>()
   .method("InitMeshShaderProgram", &GLRenderer::InitMeshShaderProgram)
+  .method("InitCompositeShaderProgram", &GLRenderer::InitCompositeShaderProgram)
   .method("InitMesh", &GLRenderer::InitMesh)
+  .method("SetVertexLayout", &GLRenderer::SetVertexLayout)
   .method("UpdateMeshBuffer", &GLRenderer::UpdateMeshBuffer)
+  .method("InitAnimatedMesh", &GLRenderer::InitAnimatedMesh)
+  .method("UpdateMeshColors", &GLRenderer::UpdateMeshColors)
+  .method("InitTerrain", &GLRenderer::InitTerrain)
+  .method("InitCachedMesh", &GLRenderer::InitCachedMesh)
+  .method("SetMeshAnimation", &GLRenderer::SetMeshAnimation)
   .method("Clear", &GLRenderer::Clear)
   .method("UseMeshShaderProgram", &GLRenderer::UseMeshShaderProgram)
   .method("DrawMesh", &GLRenderer::DrawMesh)
+  .method("InitScene", &GLRenderer::InitScene)
+  .method("AddSpin", &GLRenderer::AddSpin)
+  .method("AddAnimation", &GLRenderer::AddAnimation)
+  .method("SetAnimationFrame", &GLRenderer::SetAnimationFrame)
+  .method("SetElement", &GLRenderer::SetElement)
+  .method("GetPositions", &GLRenderer::GetPositions)
+  .method("GetOrientations", &GLRenderer::GetOrientations)
+  .method("Run", &GLRenderer::Run)
+  .method("GetStats", &GLRenderer::GetStats)
   .method("Update", &GLRenderer::Update)
-  .method("FramerateLimit", &GLRenderer::FramerateLimit)
   .method("Delete", &GLRenderer::Delete)
   .method("GetInputs", &GLRenderer::GetInputs)
   .method("SetCamera", &GLRenderer::SetCamera)
   .method("SetLights", &GLRenderer::SetLights)
   .method("WindowShouldClose", &GLRenderer::WindowShouldClose)
   .method("SaveImage", &GLRenderer::SaveImage)
+  .method("StartGif", &GLRenderer::StartGif)
+  .method("SaveFrame", &GLRenderer::SaveFrame)
+  .method("FinishImages", &GLRenderer::FinishImages)
   ;
 }
+
+RCPP_MODULE(MeshTools) {
+  function("ReadObj", &ReadObj);
+  function("SharedMeshes", &SharedMeshes);
+  function("UnpackMesh", &UnpackMesh);
+  function("GridMesh", &GridMesh);
+  function("FaceNormals", &FaceNormals);
+  function("Triangulate", &Triangulate);
+  function("SimplifyMesh", &SimplifyMesh);
+  function("WriteMeshCache", &WriteMeshCache);
+  function("MeshCacheInfo", &MeshCacheInfo);
+}
@@ -0,0 +1,28 @@
+#include "Scene.h"
+#include "Quaternion.h"
+#include "Rcpp.h"
+
+int SceneState::Camera() const {
+  for (int i = 0; i < Size(); i++) if (kinds[i] == ELEMENT_CAMERA) return i;
+  return -1;
+}
+
+bool SceneState::ApplyBehaviors(int frame, std::vector<int>& quit) {
+  bool any_quit = false;
+  for (int i = 0; i < Size(); i++) {
+    for (const NativeBehavior& behavior : behaviors[i]) {
+      if (behavior.quit_after_cycle && frame == behavior.stop_frame) {
+        Rcpp::Rcout << "Cycle completed\n";
+        quit.push_back(i);
+        any_quit = true;
+        break;
+      }
+      if (behavior.type == NATIVE_ANIMATE) {
+        layers[i] = (frame - 1) % behavior.n_frames;
+      } else {
+        RotateOrientation(&orientations[4 * i], behavior.axis, behavior.direction, behavior.angle);
+      }
+    }
+  }
+  return any_quit;
+}
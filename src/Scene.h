@@ -0,0 +1,46 @@
+#ifndef SCENE
+#define SCENE
+
+#include <vector>
+
+enum ElementKind { ELEMENT_OBJECT, ELEMENT_LIGHT, ELEMENT_CAMERA, ELEMENT_OTHER };
+
+enum NativeBehaviorType { NATIVE_SPIN, NATIVE_ANIMATE };
+
+// A behavior run natively each frame instead of calling back into R.
+// Mirrors the function returned by spin(), or the animation of st_as_obj() over time.
+struct NativeBehavior {
+  int type;
+  double axis[3];
+  int direction;  // SkewerDirection, or -1 to rotate about axis
+  double angle;
+  int n_frames;   // time steps of an animation
+  bool quit_after_cycle;
+  double stop_frame;
+};
+
+// Everything the render loop needs to draw the scene, one entry per element in scene order.
+// NaN marks a missing position, orientation, color, fov or range.
+struct SceneState {
+  std::vector<int> kinds;
+  std::vector<double> positions;     // 3 per element
+  std::vector<double> orientations;  // 4 per element, (w, x, y, z)
+  std::vector<double> colors;        // 3 per element, 0-255, used by lights
+  std::vector<double> fovs;          // used by cameras
+  std::vector<double> ranges;        // used by lights, infinite if they reach everything
+  std::vector<int> meshes;           // mesh drawn by each object, -1 otherwise
+  std::vector<bool> blended;         // objects drawn with order-independent transparency
+  std::vector<int> layers;           // time step shown by animated objects
+  std::vector<std::vector<NativeBehavior> > behaviors;
+  
+  int Size() const { return kinds.size(); }
+  
+  // Index of the first camera, or -1 if there is none.
+  int Camera() const;
+  
+  // Apply native behaviors to every element for this frame.
+  // Elements that quit the device are appended to quit. Returns true if any did.
+  bool ApplyBehaviors(int frame, std::vector<int>& quit);
+};
+
+#endif
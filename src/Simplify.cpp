@@ -0,0 +1,324 @@
+#include "Simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Weight of the planes holding boundary and color edges, relative to the planes of the faces.
+const double BOUNDARY_WEIGHT = 1000;
+
+// Sum of weighted squared distances to planes, as the upper triangle of a symmetric 4 by 4 matrix:
+// xx, xy, xz, xd, yy, yz, yd, zz, zd, dd.
+struct Quadric {
+  double q[10];
+
+  Quadric() { std::fill(q, q + 10, 0.0); }
+
+  // Add weight times the squared distance to the plane n . x + d = 0, n of unit length.
+  void AddPlane(const double* n, double d, double weight) {
+    const double p[4] = {n[0], n[1], n[2], d};
+    int k = 0;
+    for (int i = 0; i < 4; i++) for (int j = i; j < 4; j++) q[k++] += weight * p[i] * p[j];
+  }
+
+  void Add(const Quadric& other) {
+    for (int k = 0; k < 10; k++) q[k] += other.q[k];
+  }
+
+  double Error(const double* x) const {
+    return q[0] * x[0] * x[0] + 2 * q[1] * x[0] * x[1] + 2 * q[2] * x[0] * x[2] + 2 * q[3] * x[0] +
+      q[4] * x[1] * x[1] + 2 * q[5] * x[1] * x[2] + 2 * q[6] * x[1] + q[7] * x[2] * x[2] + 2 * q[8] * x[2] + q[9];
+  }
+
+  // Point of least error, unless the planes are too close to parallel to fix one.
+  bool Minimum(double* out) const {
+    // Adjugate of the symmetric 3 by 3 part, solving it against minus the last column.
+    double a[6] = {
+      q[4] * q[7] - q[5] * q[5], q[2] * q[5] - q[1] * q[7], q[1] * q[5] - q[2] * q[4],
+      q[0] * q[7] - q[2] * q[2], q[1] * q[2] - q[0] * q[5], q[0] * q[4] - q[1] * q[1]
+    };
+    double det = q[0] * a[0] + q[1] * a[1] + q[2] * a[2];
+    double trace = q[0] + q[4] + q[7];
+    if (!(std::fabs(det) > 1e-10 * trace * trace * trace)) return false;
+    out[0] = -(a[0] * q[3] + a[1] * q[6] + a[2] * q[8]) / det;
+    out[1] = -(a[1] * q[3] + a[3] * q[6] + a[4] * q[8]) / det;
+    out[2] = -(a[2] * q[3] + a[4] * q[6] + a[5] * q[8]) / det;
+    return true;
+  }
+};
+
+// Candidate collapse of vertex v into vertex u, current while both stamps are.
+struct Collapse {
+  double cost;
+  int u, v, stamp_u, stamp_v;
+  double target[3];
+  bool operator<(const Collapse& other) const { return cost > other.cost; }
+};
+
+void Cross(const double* a, const double* b, double* out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+double Dot(const double* a, const double* b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Twice the area times the unit normal of triangle a, b, c.
+void FaceNormal(const double* a, const double* b, const double* c, double* out) {
+  double ab[3], ac[3];
+  for (int k = 0; k < 3; k++) {
+    ab[k] = b[k] - a[k];
+    ac[k] = c[k] - a[k];
+  }
+  Cross(ab, ac, out);
+}
+
+class Decimator {
+public:
+  Decimator(const double* points, int n_points, const int* faces, int n_faces,
+            const Rcpp::NumericMatrix& color) : position(points, points + 3 * n_points),
+            triangles(faces, faces + 3 * (size_t) n_faces), live(n_faces, true), stamps(n_points, 0),
+            vertex_faces(n_points), quadrics(n_points), n_live(0) {
+    for (int f = 0; f < n_faces; f++) {
+      int* t = &triangles[3 * f];
+      bool valid = true;
+      for (int k = 0; k < 3; k++) {
+        valid = valid && t[k] != NA_INTEGER && t[k] >= 1 && t[k] <= n_points;
+        if (valid) t[k]--;
+      }
+      valid = valid && t[0] != t[1] && t[1] != t[2] && t[2] != t[0];
+      live[f] = valid;
+      if (!valid) continue;
+      n_live++;
+      for (int k = 0; k < 3; k++) vertex_faces[t[k]].push_back(f);
+      double normal[3];
+      FaceNormal(Position(t[0]), Position(t[1]), Position(t[2]), normal);
+      double area2 = std::sqrt(Dot(normal, normal));
+      if (area2 == 0) continue;
+      for (int k = 0; k < 3; k++) normal[k] /= area2;
+      for (int k = 0; k < 3; k++) quadrics[t[k]].AddPlane(normal, -Dot(normal, Position(t[0])), area2 / 2);
+    }
+
+    // Faces on each edge, to find the edges on the boundary or between colors.
+    std::unordered_map<uint64_t, std::pair<int, int> > edges;
+    edges.reserve(3 * (size_t) n_live);
+    for (int f = 0; f < n_faces; f++) {
+      if (!live[f]) continue;
+      for (int k = 0; k < 3; k++) {
+        std::pair<std::unordered_map<uint64_t, std::pair<int, int> >::iterator, bool> found =
+          edges.insert(std::make_pair(EdgeKey(triangles[3 * f + k], triangles[3 * f + (k + 1) % 3]), std::make_pair(f, -1)));
+        if (!found.second) found.first->second.second = found.first->second.second == -1 ? f : -2;
+      }
+    }
+    for (std::unordered_map<uint64_t, std::pair<int, int> >::iterator it = edges.begin(); it != edges.end(); ++it) {
+      int f = it->second.first, g = it->second.second;
+      if (g >= 0 && SameColor(color, f, g)) continue;
+      HoldEdge((int) (it->first >> 32), (int) (it->first & 0xFFFFFFFF), f);
+    }
+    for (std::unordered_map<uint64_t, std::pair<int, int> >::iterator it = edges.begin(); it != edges.end(); ++it) {
+      Push((int) (it->first >> 32), (int) (it->first & 0xFFFFFFFF));
+    }
+  }
+
+  void Run(int target_faces) {
+    while (n_live > target_faces && !heap.empty()) {
+      Collapse c = heap.top();
+      heap.pop();
+      if (stamps[c.u] != c.stamp_u || stamps[c.v] != c.stamp_v || !Allowed(c)) continue;
+      Apply(c);
+    }
+  }
+
+  // 1-based faces kept, and the positions and 1-based indices of the simplified mesh.
+  Rcpp::List Result() const {
+    int n_points = stamps.size(), n_faces = live.size();
+    std::vector<int> renumber(n_points, 0);
+    for (int f = 0; f < n_faces; f++) {
+      if (live[f]) for (int k = 0; k < 3; k++) renumber[triangles[3 * f + k]] = 1;
+    }
+    int n_kept = 0;
+    for (int i = 0; i < n_points; i++) if (renumber[i]) renumber[i] = ++n_kept;
+
+    Rcpp::NumericMatrix out_positions(3, n_kept);
+    for (int i = 0; i < n_points; i++) {
+      if (renumber[i]) std::copy(Position(i), Position(i) + 3, out_positions.begin() + 3 * (renumber[i] - 1));
+    }
+    Rcpp::IntegerMatrix out_indices(3, n_live);
+    Rcpp::IntegerVector out_faces(n_live);
+    for (int f = 0, t = 0; f < n_faces; f++) {
+      if (!live[f]) continue;
+      for (int k = 0; k < 3; k++) out_indices[3 * t + k] = renumber[triangles[3 * f + k]];
+      out_faces[t++] = f + 1;
+    }
+    return Rcpp::List::create(
+      Rcpp::Named("positions") = out_positions,
+      Rcpp::Named("indices") = out_indices,
+      Rcpp::Named("faces") = out_faces
+    );
+  }
+
+private:
+  static uint64_t EdgeKey(int a, int b) {
+    return ((uint64_t) std::min(a, b) << 32) | (uint64_t) std::max(a, b);
+  }
+
+  static bool SameColor(const Rcpp::NumericMatrix& color, int f, int g) {
+    int rows = color.nrow(), cols = color.ncol();
+    if (cols <= 1) return true;
+    const double* a = color.begin() + (size_t) (f % cols) * rows;
+    const double* b = color.begin() + (size_t) (g % cols) * rows;
+    return std::equal(a, a + rows, b);
+  }
+
+  const double* Position(int i) const { return &position[3 * (size_t) i]; }
+
+  // Plane through edge a-b at right angles to face f, weighted by the squared length of the edge.
+  void HoldEdge(int a, int b, int f) {
+    const int* t = &triangles[3 * f];
+    double normal[3], edge[3], across[3];
+    FaceNormal(Position(t[0]), Position(t[1]), Position(t[2]), normal);
+    for (int k = 0; k < 3; k++) edge[k] = Position(b)[k] - Position(a)[k];
+    Cross(edge, normal, across);
+    double length = std::sqrt(Dot(across, across));
+    if (length == 0) return;
+    for (int k = 0; k < 3; k++) across[k] /= length;
+    double weight = BOUNDARY_WEIGHT * Dot(edge, edge);
+    double d = -Dot(across, Position(a));
+    quadrics[a].AddPlane(across, d, weight);
+    quadrics[b].AddPlane(across, d, weight);
+  }
+
+  // Queue the collapse of edge u-v to the point of least error, or failing that the best of its ends and middle.
+  void Push(int u, int v) {
+    Quadric q = quadrics[u];
+    q.Add(quadrics[v]);
+    Collapse c;
+    c.u = u;
+    c.v = v;
+    c.stamp_u = stamps[u];
+    c.stamp_v = stamps[v];
+    if (q.Minimum(c.target)) {
+      c.cost = q.Error(c.target);
+    } else {
+      const double* a = Position(u);
+      const double* b = Position(v);
+      double candidates[3][3];
+      for (int k = 0; k < 3; k++) {
+        candidates[0][k] = a[k];
+        candidates[1][k] = b[k];
+        candidates[2][k] = (a[k] + b[k]) / 2;
+      }
+      c.cost = INFINITY;
+      for (int i = 0; i < 3; i++) {
+        double cost = q.Error(candidates[i]);
+        if (cost < c.cost) {
+          c.cost = cost;
+          std::copy(candidates[i], candidates[i] + 3, c.target);
+        }
+      }
+    }
+    heap.push(c);
+  }
+
+  void Neighbours(int u, std::vector<int>& out) const {
+    out.clear();
+    for (size_t i = 0; i < vertex_faces[u].size(); i++) {
+      const int* t = &triangles[3 * vertex_faces[u][i]];
+      for (int k = 0; k < 3; k++) if (t[k] != u) out.push_back(t[k]);
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+  }
+
+  // Whether collapsing keeps the surface a manifold, every neighbour shared by u and v lying on a face
+  // with both, and turns no face over. A point is on the boundary if it has more neighbours than faces.
+  bool Allowed(const Collapse& c) {
+    int shared = 0;
+    for (size_t i = 0; i < vertex_faces[c.u].size(); i++) {
+      const int* t = &triangles[3 * vertex_faces[c.u][i]];
+      shared += t[0] == c.v || t[1] == c.v || t[2] == c.v;
+    }
+    if (shared == 0) return false;
+    Neighbours(c.u, around_u);
+    Neighbours(c.v, around_v);
+    common.clear();
+    std::set_intersection(around_u.begin(), around_u.end(), around_v.begin(), around_v.end(), std::back_inserter(common));
+    if ((int) common.size() != shared) return false;
+    // An edge across the surface joining two points of its boundary would pinch it in two.
+    bool boundary_u = around_u.size() != vertex_faces[c.u].size(), boundary_v = around_v.size() != vertex_faces[c.v].size();
+    if (shared == 2 && boundary_u && boundary_v) return false;
+
+    const int ends[2] = {c.u, c.v};
+    for (int e = 0; e < 2; e++) {
+      const std::vector<int>& faces = vertex_faces[ends[e]];
+      for (size_t i = 0; i < faces.size(); i++) {
+        const int* t = &triangles[3 * faces[i]];
+        if ((t[0] == c.u || t[1] == c.u || t[2] == c.u) && (t[0] == c.v || t[1] == c.v || t[2] == c.v)) continue;
+        const double* moved[3];
+        for (int k = 0; k < 3; k++) moved[k] = t[k] == ends[e] ? c.target : Position(t[k]);
+        double before[3], after[3];
+        FaceNormal(Position(t[0]), Position(t[1]), Position(t[2]), before);
+        FaceNormal(moved[0], moved[1], moved[2], after);
+        if (Dot(before, after) <= 0) return false;
+      }
+    }
+    return true;
+  }
+
+  void Apply(const Collapse& c) {
+    std::copy(c.target, c.target + 3, &position[3 * (size_t) c.u]);
+    quadrics[c.u].Add(quadrics[c.v]);
+    std::vector<int>& faces_u = vertex_faces[c.u];
+    std::vector<int>& faces_v = vertex_faces[c.v];
+    std::vector<int> touched;  // vertices of the faces removed
+    for (size_t i = 0; i < faces_v.size(); i++) {
+      int f = faces_v[i];
+      int* t = &triangles[3 * f];
+      if (t[0] == c.u || t[1] == c.u || t[2] == c.u) {
+        live[f] = false;
+        n_live--;
+        touched.insert(touched.end(), t, t + 3);
+      } else {
+        for (int k = 0; k < 3; k++) if (t[k] == c.v) t[k] = c.u;
+        faces_u.push_back(f);
+      }
+    }
+    for (size_t i = 0; i < touched.size(); i++) {
+      std::vector<int>& faces = vertex_faces[touched[i]];
+      faces.erase(std::remove_if(faces.begin(), faces.end(), [this](int f) { return !live[f]; }), faces.end());
+    }
+    std::vector<int>().swap(faces_v);
+    stamps[c.v] = -1;
+    stamps[c.u]++;
+    Neighbours(c.u, around_u);
+    for (size_t i = 0; i < around_u.size(); i++) Push(c.u, around_u[i]);
+  }
+
+  std::vector<double> position;
+  std::vector<int> triangles;   // 0-based, with faces removed by a collapse left in place
+  std::vector<bool> live;
+  std::vector<int> stamps;      // changed by each collapse of a vertex, -1 once it is collapsed away
+  std::vector<std::vector<int> > vertex_faces;
+  std::vector<Quadric> quadrics;
+  std::priority_queue<Collapse> heap;
+  std::vector<int> around_u, around_v, common;
+  int n_live;
+};
+
+}
+
+Rcpp::List SimplifyMesh(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices, Rcpp::NumericMatrix color,
+                        int target_faces) {
+  if (positions.nrow() != 3) Rcpp::stop("positions must have 3 rows");
+  if (indices.nrow() != 3) Rcpp::stop("indices must have 3 rows");
+  Decimator decimator(positions.begin(), positions.ncol(), indices.begin(), indices.ncol(), color);
+  decimator.Run(std::max(target_faces, 0));
+  return decimator.Result();
+}
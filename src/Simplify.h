@@ -0,0 +1,17 @@
+#ifndef SIMPLIFY
+#define SIMPLIFY
+
+#include "Rcpp.h"
+
+// Triangles of a triangulated scenesetr_obj decimated to at most target_faces by quadric error edge
+// collapse (Garland and Heckbert), collapsing first the edges whose merged vertex moves least from the
+// planes of the faces around it. color has one column for every face or one for the whole object;
+// edges on the boundary of the surface or between faces of different colors are held by extra planes
+// across them, so outlines and the borders between colors are kept where possible. Collapses that
+// would flip a face or pinch the surface are skipped, so more than target_faces may remain if no
+// other collapse is left. Returns the positions, the 1-based indices, and the 1-based face of
+// the input kept as each output face, in their original order.
+Rcpp::List SimplifyMesh(Rcpp::NumericMatrix positions, Rcpp::IntegerMatrix indices, Rcpp::NumericMatrix color,
+                        int target_faces);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef STREAM_BUFFER
+#define STREAM_BUFFER
+
+#include <glad/glad.h>
+#include <cstddef>
+#include "Rcpp.h"
+
+// Segments of a StreamBuffer: one being written, and up to two more still being drawn from.
+const int STREAM_SEGMENTS = 3;
+
+// Array buffer rewritten every frame, used as a ring of STREAM_SEGMENTS segments so that the next
+// segment is written while the GPU may still be drawing from the others. Each segment is fenced
+// when writing moves on from it and waited on only when the ring comes back round to it, so writes
+// map the buffer unsynchronized and it is only reallocated when a write outgrows its segments.
+class StreamBuffer {
+public:
+  StreamBuffer() : buffer(0), segment_size(0), current(0) {
+    for (int s = 0; s < STREAM_SEGMENTS; s++) fences[s] = 0;
+  }
+
+  // Write size bytes into the next segment through write(pointer), leaving the buffer bound to
+  // GL_ARRAY_BUFFER. Returns the offset of the segment in Buffer().
+  template <typename F>
+  size_t Write(size_t size, F write) {
+    if (buffer == 0) glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (size > segment_size) {
+      // Draws already queued keep the old storage alive, so no segment needs waiting for.
+      DeleteFences();
+      segment_size = (size + 255) / 256 * 256;
+      glBufferData(GL_ARRAY_BUFFER, STREAM_SEGMENTS * segment_size, NULL, GL_STREAM_DRAW);
+      current = 0;
+    } else {
+      fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      current = (current + 1) % STREAM_SEGMENTS;
+      Wait(current);
+    }
+    size_t offset = current * segment_size;
+    if (size == 0) return offset;
+    void* out = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (out == NULL) Rcpp::stop("cannot map a buffer of %.0f bytes", (double) size);
+    write((unsigned char*) out);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    return offset;
+  }
+
+  // 0 until the first Write().
+  GLuint Buffer() const {
+    return buffer;
+  }
+
+  void Delete() {
+    DeleteFences();
+    if (buffer != 0) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    segment_size = 0;
+  }
+
+private:
+  // Block until the GPU has finished every command issued before segment s was last moved on from.
+  void Wait(int s) {
+    if (fences[s] == 0) return;
+    GLenum status = glClientWaitSync(fences[s], 0, 0);
+    while (status == GL_TIMEOUT_EXPIRED) {
+      status = glClientWaitSync(fences[s], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    }
+    glDeleteSync(fences[s]);
+    fences[s] = 0;
+  }
+
+  void DeleteFences() {
+    for (int s = 0; s < STREAM_SEGMENTS; s++) {
+      if (fences[s] != 0) glDeleteSync(fences[s]);
+      fences[s] = 0;
+    }
+  }
+
+  GLuint buffer;
+  size_t segment_size;
+  int current;
+  GLsync fences[STREAM_SEGMENTS];
+};
+
+#endif
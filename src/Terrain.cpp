@@ -0,0 +1,273 @@
+#include "Terrain.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+struct TileSpec {
+  int x0, y0, stride, parent;
+};
+
+// Vertices, indices and skirt edges of one tile, with indices local to the tile.
+struct TileMesh {
+  std::vector<float> vertices;
+  std::vector<GLuint> indices;
+  std::vector<int> color_columns;
+  std::vector<int> edges; // pairs of vertices along tile edges inside the grid
+  double error = 0;
+};
+
+double Distance(const double* a, const double* b) {
+  double d[3] = {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+  return std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+}
+
+// Grid cell numbered as in the color of st_as_obj(): valid cells in grid order, or -1.
+std::vector<int> CellNumbers(const RasterGrid& grid, ThreadPool& pool) {
+  std::vector<int> start(grid.ny + 1, 0), numbers(grid.nx * grid.ny, -1);
+  pool.ParallelFor(grid.ny, [&](int from, int to) {
+    for (int j = from; j < to; j++) for (int i = 0; i < grid.nx; i++) start[j + 1] += grid.Valid(i, j);
+  });
+  for (int j = 0; j < grid.ny; j++) start[j + 1] += start[j];
+  pool.ParallelFor(grid.ny, [&](int from, int to) {
+    for (int j = from; j < to; j++) {
+      int cell = start[j];
+      for (int i = 0; i < grid.nx; i++) if (grid.Valid(i, j)) numbers[j * grid.nx + i] = cell++;
+    }
+  });
+  return numbers;
+}
+
+// Split a coarse cell with corners q (in the order of GridMesh()) into two triangles, as GridMesh() does.
+// Every cell of a coarse level is colored by the first valid grid cell it covers.
+void AddCell(const double q[4][3], int cell, const double* color, int color_rows, int color_cols, TileMesh& out) {
+  const int split[2][3] = {{0, 1, 2}, {2, 3, 0}};
+  int column = color_cols == 1 ? 0 : cell % color_cols;
+  for (int t = 0; t < 2; t++) {
+    const double* p[3] = {q[split[t][0]], q[split[t][1]], q[split[t][2]]};
+    double normal[3];
+    TriangleNormal(p, normal);
+    for (int k = 0; k < 3; k++) {
+      out.indices.push_back(out.vertices.size() / 10);
+      out.vertices.insert(out.vertices.end(), p[k], p[k] + 3);
+      out.vertices.insert(out.vertices.end(), normal, normal + 3);
+      for (int c = 0; c < 4; c++) out.vertices.push_back(c < color_rows ? color[column * color_rows + c] / 255 : 1);
+      out.color_columns.push_back(cell);
+    }
+  }
+}
+
+// Distance of used grid corner (i, j) in the coarse cell [i0, i1] x [j0, j1] from its triangles.
+double CornerError(const RasterGrid& grid, int i, int j, int i0, int j0, int i1, int j1, const double q[4][3]) {
+  double height = grid.CornerRelief(i, j);
+  if (ISNAN(height)) return 0;
+  double p[3], fitted[3];
+  grid.CornerPosition(i, j, height, p);
+  double u = (double) (i - i0) / (i1 - i0), v = (double) (j - j0) / (j1 - j0);
+  // q is (1, 0), (1, 1), (0, 1), (0, 0) in (u, v), split along u + v = 1.
+  double w[4] = {0, 0, 0, 0};
+  if (u + v >= 1) {
+    w[0] = 1 - v; w[1] = u + v - 1; w[2] = 1 - u;
+  } else {
+    w[2] = v; w[3] = 1 - u - v; w[0] = u;
+  }
+  for (int c = 0; c < 3; c++) fitted[c] = w[0] * q[0][c] + w[1] * q[1][c] + w[2] * q[2][c] + w[3] * q[3][c];
+  return Distance(p, fitted);
+}
+
+TileMesh BuildTile(const RasterGrid& grid, const TileSpec& spec, const std::vector<int>& cells,
+                   const double* color, int color_rows, int color_cols) {
+  TileMesh out;
+  const int n = TERRAIN_TILE_CELLS, s = spec.stride;
+  bool inner_left = spec.x0 > 0, inner_top = spec.y0 > 0;
+  bool inner_right = spec.x0 + n * s < grid.nx, inner_bottom = spec.y0 + n * s < grid.ny;
+
+  for (int b = 0; b < n; b++) {
+    int j0 = spec.y0 + b * s, j1 = std::min(j0 + s, grid.ny);
+    if (j0 >= grid.ny) break;
+    for (int a = 0; a < n; a++) {
+      int i0 = spec.x0 + a * s, i1 = std::min(i0 + s, grid.nx);
+      if (i0 >= grid.nx) break;
+
+      // The first valid grid cell covered, whose relief stands in for corners no valid cell uses.
+      int first = -1;
+      for (int j = j0; j < j1 && first < 0; j++) {
+        for (int i = i0; i < i1 && first < 0; i++) if (grid.Valid(i, j)) first = j * grid.nx + i;
+      }
+      if (first < 0) continue;
+
+      const int ci[4] = {i1, i1, i0, i0}, cj[4] = {j0, j1, j1, j0};
+      double q[4][3];
+      for (int k = 0; k < 4; k++) {
+        double height = grid.CornerRelief(ci[k], cj[k]);
+        grid.CornerPosition(ci[k], cj[k], ISNAN(height) ? grid.relief[first] : height, q[k]);
+      }
+
+      size_t v = out.vertices.size() / 10;
+      AddCell(q, cells[first], color, color_rows, color_cols, out);
+
+      if (s > 1) {
+        for (int j = j0; j <= j1; j++) {
+          for (int i = i0; i <= i1; i++) out.error = std::max(out.error, CornerError(grid, i, j, i0, j0, i1, j1, q));
+        }
+      }
+
+      // Vertices 0-1 of the cell lie on its right edge, 1-2 bottom, 3-4 left and 4-5 top.
+      const int edge[4][2] = {{0, 1}, {1, 2}, {3, 4}, {4, 5}};
+      const bool on_edge[4] = {
+        inner_right && a == n - 1, inner_bottom && b == n - 1, inner_left && a == 0, inner_top && b == 0
+      };
+      for (int e = 0; e < 4; e++) {
+        if (!on_edge[e]) continue;
+        out.edges.push_back(v + edge[e][0]);
+        out.edges.push_back(v + edge[e][1]);
+      }
+    }
+  }
+  return out;
+}
+
+// Hang a skirt of the given depth from each edge of the tile, toward the center of a globe or down.
+void AddSkirts(TileMesh& tile, bool globe, double depth) {
+  for (size_t e = 0; e < tile.edges.size(); e += 2) {
+    GLuint top[2] = {(GLuint) tile.edges[e], (GLuint) tile.edges[e + 1]}, bottom[2];
+    for (int k = 0; k < 2; k++) {
+      std::vector<float> vertex(&tile.vertices[10 * top[k]], &tile.vertices[10 * top[k]] + 10);
+      double down[3] = {0, 1, 0};
+      if (globe) {
+        double length = std::sqrt(vertex[0] * vertex[0] + vertex[1] * vertex[1] + vertex[2] * vertex[2]);
+        for (int c = 0; c < 3; c++) down[c] = vertex[c] / length;
+      }
+      for (int c = 0; c < 3; c++) vertex[c] -= down[c] * depth;
+      bottom[k] = tile.vertices.size() / 10;
+      tile.vertices.insert(tile.vertices.end(), vertex.begin(), vertex.end());
+      tile.color_columns.push_back(tile.color_columns[top[k]]);
+    }
+    const GLuint quad[6] = {top[0], top[1], bottom[1], bottom[1], bottom[0], top[0]};
+    tile.indices.insert(tile.indices.end(), quad, quad + 6);
+  }
+}
+
+}
+
+Terrain::Terrain(const RasterGrid& grid, const double* color, int color_rows, int color_cols, double tolerance,
+                 std::vector<float>& vertices, std::vector<GLuint>& indices, std::vector<int>& color_columns)
+  : tolerance(tolerance) {
+  ThreadPool pool;
+  std::vector<int> cells = CellNumbers(grid, pool);
+
+  // The root covers the whole grid at the stride that fits it in one tile.
+  int root_stride = 1;
+  while ((double) TERRAIN_TILE_CELLS * root_stride < std::max(grid.nx, grid.ny)) root_stride *= 2;
+  std::vector<TileSpec> specs(1, TileSpec{0, 0, root_stride, -1});
+  for (size_t t = 0; t < specs.size(); t++) {
+    TileSpec spec = specs[t];
+    if (spec.stride == 1) continue;
+    int half = TERRAIN_TILE_CELLS * spec.stride / 2;
+    for (int k = 0; k < 4; k++) {
+      TileSpec child = {spec.x0 + k % 2 * half, spec.y0 + k / 2 * half, spec.stride / 2, (int) t};
+      if (child.x0 < grid.nx && child.y0 < grid.ny) specs.push_back(child);
+    }
+  }
+
+  std::vector<TileMesh> meshes(specs.size());
+  pool.ParallelFor(specs.size(), [&](int from, int to) {
+    for (int t = from; t < to; t++) meshes[t] = BuildTile(grid, specs[t], cells, color, color_rows, color_cols);
+  });
+
+  // Children follow their parents, so walking backwards sees every child before its parent.
+  std::vector<bool> kept(specs.size());
+  tiles.resize(specs.size());
+  for (int t = specs.size() - 1; t >= 0; t--) {
+    TerrainTile& tile = tiles[t];
+    std::fill(tile.children, tile.children + 4, -1);
+    tile.error = std::max(tile.error, meshes[t].error);
+    kept[t] = kept[t] || !meshes[t].indices.empty();
+    int parent = specs[t].parent;
+    if (parent >= 0 && kept[t]) {
+      kept[parent] = true;
+      tiles[parent].error = std::max(tiles[parent].error, tile.error);
+    }
+  }
+
+  // Skirts reach as far as the coarser level a neighbour is likely drawn at.
+  pool.ParallelFor(specs.size(), [&](int from, int to) {
+    for (int t = from; t < to; t++) {
+      int parent = specs[t].parent;
+      AddSkirts(meshes[t], grid.globe, 2 * tiles[parent < 0 ? t : parent].error);
+    }
+  });
+
+  std::vector<int> renumbered(specs.size(), -1);
+  int n_kept = 0;
+  for (size_t t = 0; t < specs.size(); t++) {
+    if (!kept[t]) continue;
+    renumbered[t] = n_kept;
+    TerrainTile tile = tiles[t];
+    TileMesh& mesh = meshes[t];
+    GLuint offset = vertices.size() / 10;
+    tile.first = indices.size();
+    tile.count = mesh.indices.size();
+    for (GLuint index : mesh.indices) indices.push_back(offset + index);
+    vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+    color_columns.insert(color_columns.end(), mesh.color_columns.begin(), mesh.color_columns.end());
+
+    double low[3] = {INFINITY, INFINITY, INFINITY}, high[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t i = 0; i < mesh.vertices.size(); i += 10) {
+      for (int c = 0; c < 3; c++) {
+        low[c] = std::min(low[c], (double) mesh.vertices[i + c]);
+        high[c] = std::max(high[c], (double) mesh.vertices[i + c]);
+      }
+    }
+    tile.radius = 0;
+    for (int c = 0; c < 3; c++) tile.center[c] = (low[c] + high[c]) / 2;
+    for (size_t i = 0; i < mesh.vertices.size(); i += 10) {
+      const double p[3] = {mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]};
+      tile.radius = std::max(tile.radius, Distance(p, tile.center));
+    }
+    tile.radius += tile.error;
+    tiles[n_kept++] = tile;
+    mesh = TileMesh();
+
+    int parent = specs[t].parent;
+    if (parent < 0) continue;
+    int* children = tiles[renumbered[parent]].children;
+    *std::find(children, children + 4, -1) = renumbered[t];
+  }
+  tiles.resize(n_kept);
+}
+
+void Terrain::Select(const double* camera, const Frustum& frustum, double pixels_per_unit, 
+                     std::vector<GLsizei>& ranges, CullStats& stats) const {
+  ranges.clear();
+  if (!tiles.empty()) SelectTile(0, camera, frustum, pixels_per_unit, ranges, stats);
+}
+
+void Terrain::SelectTile(int t, const double* camera, const Frustum& frustum, double pixels_per_unit, 
+                         std::vector<GLsizei>& ranges, CullStats& stats) const {
+  const TerrainTile& tile = tiles[t];
+  if (!frustum.Sees(tile.center, tile.radius)) {
+    stats.culled++;
+    return;
+  }
+  double distance = Distance(camera, tile.center) - tile.radius;
+  bool refine = tile.children[0] >= 0 && (distance <= 0 || tile.error * pixels_per_unit / distance > tolerance);
+  if (refine) {
+    for (int k = 0; k < 4 && tile.children[k] >= 0; k++) {
+      SelectTile(tile.children[k], camera, frustum, pixels_per_unit, ranges, stats);
+    }
+    return;
+  }
+  if (tile.count == 0) return;
+  stats.drawn++;
+  // Neighbouring tiles are often next to each other in the index buffer too.
+  size_t n = ranges.size();
+  if (n > 0 && ranges[n - 2] + ranges[n - 1] == tile.first) {
+    ranges[n - 1] += tile.count;
+  } else {
+    ranges.push_back(tile.first);
+    ranges.push_back(tile.count);
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef TERRAIN
+#define TERRAIN
+
+#include <glad/glad.h>
+#include <vector>
+#include "GridMesh.h"
+#include "Frustum.h"
+
+// Cells along each side of a tile, at every level of detail.
+const int TERRAIN_TILE_CELLS = 32;
+
+// Tile of the quadtree, covering TERRAIN_TILE_CELLS by TERRAIN_TILE_CELLS coarse cells of
+// stride by stride cells of the grid. Its children halve the stride.
+struct TerrainTile {
+  GLsizei first, count;    // range of the index buffer
+  double center[3], radius; // bounding sphere
+  double error;            // furthest distance of the tile or its descendants from the full-resolution surface
+  int children[4];         // index of each child tile, -1 where absent
+};
+
+// Raster surface drawn as a quadtree of tiles, each precomputed at its own level of detail,
+// so that distant parts of a large grid are drawn with few triangles.
+class Terrain {
+public:
+
+  Terrain() {}
+
+  // Tiles of grid, appending their vertices (10 floats each, as taken by Mesh), triangle indices
+  // and the column of color of each vertex. color has color_rows rows of values 0-255 and one column
+  // for the whole grid or one per cell, recycled. Tile edges inside the grid hang skirts down to
+  // hide cracks between neighbouring tiles drawn at different levels.
+  Terrain(const RasterGrid& grid, const double* color, int color_rows, int color_cols, double tolerance,
+          std::vector<float>& vertices, std::vector<GLuint>& indices, std::vector<int>& color_columns);
+
+  // Terrain of tiles built before, as kept in a MeshCache file.
+  Terrain(const TerrainTile* tiles, size_t n_tiles, double tolerance) 
+    : tiles(tiles, tiles + n_tiles), tolerance(tolerance) {}
+
+  // Index ranges, as pairs of first index and count, of the coarsest tiles whose error on screen
+  // is within tolerance pixels as seen from camera, leaving out tiles outside frustum. Both are given 
+  // in the terrain's own coordinates. pixels_per_unit is the height on screen of one unit at a distance 
+  // of one. Tiles drawn and culled are added to stats.
+  void Select(const double* camera, const Frustum& frustum, double pixels_per_unit, 
+              std::vector<GLsizei>& ranges, CullStats& stats) const;
+
+  const std::vector<TerrainTile>& Tiles() const { return tiles; }
+  double Tolerance() const { return tolerance; }
+
+private:
+  void SelectTile(int t, const double* camera, const Frustum& frustum, double pixels_per_unit, 
+                  std::vector<GLsizei>& ranges, CullStats& stats) const;
+
+  std::vector<TerrainTile> tiles; // root first, then each tile before its descendants
+  double tolerance;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued jobs in submission order.
+// Jobs must not call the R API.
+class ThreadPool {
+public:
+  
+  ThreadPool(int n_threads = DefaultThreads()) {
+    for (int i = 0; i < n_threads; i++) workers.emplace_back(&ThreadPool::Work, this);
+  }
+  
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    jobAdded.notify_all();
+    for (std::thread& worker : workers) worker.join();
+  }
+  
+  // Queue a job, first waiting while more than max_queued jobs are waiting to start.
+  void Submit(std::function<void()> job, size_t max_queued = SIZE_MAX) {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobTaken.wait(lock, [&] { return jobs.size() < max_queued; });
+    jobs.push(std::move(job));
+    unfinished++;
+    jobAdded.notify_one();
+  }
+  
+  // Block until every submitted job has finished.
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [&] { return unfinished == 0; });
+  }
+  
+  // Run f(from, to) over blocks of [0, n) on the workers, waiting until all are done.
+  void ParallelFor(int n, const std::function<void(int, int)>& f) {
+    int block = std::max(1, n / (4 * Size()));
+    for (int from = 0; from < n; from += block) {
+      int to = std::min(n, from + block);
+      Submit([&f, from, to] { f(from, to); });
+    }
+    Wait();
+  }
+  
+  int Size() const {
+    return workers.size();
+  }
+  
+  static int DefaultThreads() {
+    int n = std::thread::hardware_concurrency();
+    return n > 1 ? n - 1 : 1;
+  }
+  
+private:
+  
+  void Work() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobAdded.wait(lock, [&] { return stopping || !jobs.empty(); });
+        if (jobs.empty()) return;
+        job = std::move(jobs.front());
+        jobs.pop();
+      }
+      jobTaken.notify_one();
+      job();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        unfinished--;
+      }
+      jobDone.notify_all();
+    }
+  }
+  
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable jobAdded, jobTaken, jobDone;
+  size_t unfinished = 0;
+  bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "Transparency.h"
+#include "Rcpp.h"
+
+Transparency::Transparency() : program(0), vertexArray(0), framebuffer(0), depth(0), width(0), height(0) {
+  textures[0] = textures[1] = 0;
+}
+
+void Transparency::Init(GLuint composite_program) {
+  program = composite_program;
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "accumulation"), ACCUMULATION_UNIT);
+  glUniform1i(glGetUniformLocation(program, "weights"), WEIGHTS_UNIT);
+  // The full-screen triangle is made from gl_VertexID alone, but a vertex array must still be bound.
+  glGenVertexArrays(1, &vertexArray);
+}
+
+void Transparency::Begin(GLuint depthbuffer, int width, int height) {
+  if (framebuffer == 0) {
+    glGenFramebuffers(1, &framebuffer);
+    glGenTextures(2, textures);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  if (width != this->width || height != this->height) {
+    const GLenum formats[2] = {GL_RGBA16F, GL_R16F}, layouts[2] = {GL_RGBA, GL_RED};
+    for (int t = 0; t < 2; t++) {
+      glBindTexture(GL_TEXTURE_2D, textures[t]);
+      glTexImage2D(GL_TEXTURE_2D, 0, formats[t], width, height, 0, layouts[t], GL_FLOAT, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + t, GL_TEXTURE_2D, textures[t], 0);
+    }
+    const GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, buffers);
+    this->width = width;
+    this->height = height;
+  }
+  if (depthbuffer != depth) {
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+    depth = depthbuffer;
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      Rcpp::Rcout << "ERROR: TRANSPARENCY FRAMEBUFFER INCOMPLETE" << std::endl;
+    }
+  }
+
+  // Nothing accumulated, and all light revealed.
+  const GLfloat accumulation[4] = {0, 0, 0, 1}, weights[4] = {0, 0, 0, 0};
+  glClearBufferfv(GL_COLOR, 0, accumulation);
+  glClearBufferfv(GL_COLOR, 1, weights);
+  glDepthMask(GL_FALSE);
+  // Colors and weights add up, and alpha multiplies down the light revealed. OpenGL 3.3 has one
+  // blend function for every target, so revealage rides in the alpha of the accumulation target.
+  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void Transparency::Composite(GLuint scene, GLuint mesh_program) {
+  glBindFramebuffer(GL_FRAMEBUFFER, scene);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glDisable(GL_DEPTH_TEST);
+  glUseProgram(program);
+  for (int t = 0; t < 2; t++) {
+    glActiveTexture(GL_TEXTURE0 + ACCUMULATION_UNIT + t);
+    glBindTexture(GL_TEXTURE_2D, textures[t]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindVertexArray(vertexArray);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+  glUseProgram(mesh_program);
+  glEnable(GL_DEPTH_TEST);
+  glDepthMask(GL_TRUE);
+}
+
+void Transparency::Delete() {
+  if (framebuffer != 0) {
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(2, textures);
+  }
+  glDeleteVertexArrays(1, &vertexArray);
+  glDeleteProgram(program);
+}
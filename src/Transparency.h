@@ -0,0 +1,37 @@
+#ifndef TRANSPARENCY
+#define TRANSPARENCY
+
+#include <glad/glad.h>
+
+// Texture units of the samplers of composite.frag, apart from those of mesh.frag.
+enum TransparencyTextureUnit { ACCUMULATION_UNIT = 4, WEIGHTS_UNIT = 5 };
+
+// Weighted blended order-independent transparency (McGuire and Bavoil 2013). Objects drawn between
+// Begin() and Composite() add their premultiplied colors, scaled by a weight that falls with depth, into
+// an accumulation target whose alpha multiplies down the light revealed through them, and their weights
+// into a second target. Composite() then blends the weighted average color over the scene by the light
+// they block, so the result does not depend on the order they were drawn in. Both targets share the
+// depth buffer of the scene, so opaque surfaces still hide what is behind them.
+class Transparency {
+public:
+  Transparency();
+
+  // Take the program of composite.vert and composite.frag.
+  void Init(GLuint composite_program);
+
+  // Draw from now on into the accumulation targets, width by height, depth tested against but not
+  // writing to depthbuffer. mesh.frag must be told to write weighted colors.
+  void Begin(GLuint depthbuffer, int width, int height);
+
+  // Blend what was drawn since Begin() over the framebuffer scene, leaving it bound with the mesh
+  // program in use and the usual blending restored.
+  void Composite(GLuint scene, GLuint mesh_program);
+
+  void Delete();
+
+private:
+  GLuint program, vertexArray, framebuffer, textures[2], depth;
+  int width, height;
+};
+
+#endif
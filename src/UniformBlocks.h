@@ -0,0 +1,25 @@
+#ifndef UNIFORM_BLOCKS
+#define UNIFORM_BLOCKS
+
+// std140 layouts of the uniform blocks declared in mesh.vert and mesh.frag.
+
+const int MAX_LIGHTS = 100;
+
+enum UniformBlockBinding { CAMERA_BINDING = 0, LIGHTS_BINDING = 1 };
+
+struct CameraBlock {
+  float projMat[16];
+  float camPos[4];
+  float camQuat[4];  // (x, y, z, w)
+};
+
+// Lights without a range, shaded by every fragment. Lights with one are in LightClusters.
+struct LightsBlock {
+  int nlights;
+  int padding[3];
+  int clusterCounts[4];    // CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z and the number of local lights
+  float clusterDepths[4];  // near plane and depth slices per unit of log depth
+  float lights[3 * MAX_LIGHTS][4];  // position, direction and color of each light
+};
+
+#endif